@@ -33,6 +33,8 @@ void argolib_kernel(fork_t fptr, void *args)
 
 /**
  * Creates an Argobot ULT that would execute a user method with the specified argument.
+ * With ARGOLIB_LAZY set, the method may instead run right away when the worker already has
+ * enough tasks queued; the returned handle must still be joined.
  * It returns a pointer to the task handle that would be used for joining this ULT.
  * *It is the responsibility of the user to create a data structure capable of storing 
  * the created tasks in a recursive program.* Maybe not, threads array has all the created tasks.
@@ -42,6 +44,35 @@ Task_handle *argolib_fork(fork_t fptr, void *args)
         return argolib_core_fork(fptr, args);
 }
 
+/**
+ * Like argolib_fork, but creates an Argobots tasklet instead of a ULT. A tasklet has no stack
+ * of its own, so it is cheaper to create and to run, but the method must not fork and join,
+ * use a finish scope or block in any other way. Meant for the leaves of a recursion.
+ * The returned handle is joined with argolib_join like any other.
+ */
+Task_handle *argolib_fork_leaf(fork_t fptr, void *args)
+{
+        return argolib_core_fork_leaf(fptr, args);
+}
+
+/**
+ * Like argolib_fork, but the ULT gets a stack of stack_size bytes instead of the default one.
+ * Use it for tasks that recurse deeper, or much less deep, than the rest.
+ */
+Task_handle *argolib_fork_stack(fork_t fptr, void *args, size_t stack_size)
+{
+        return argolib_core_fork_stack(fptr, args, stack_size);
+}
+
+/**
+ * Sets the stack size, in bytes, of the ULTs forked from now on. 0 restores the Argobots default.
+ * The initial value comes from ARGOLIB_STACK_SIZE.
+ */
+void argolib_set_stack_size(size_t stack_size)
+{
+        argolib_core_set_stack_size(stack_size);
+}
+
 /**
  * Used for joining one more ULTs using the corresponding task handles. In case of more than one
  * task handles, user can pass an array of Task_handle*. The parameter “size” is the array size.
@@ -55,5 +86,118 @@ void argolib_join(Task_handle **list, int size)
         argolib_core_join(list, size);
 }
 
+/**
+ * Creates an Argobot ULT that would execute a user method with the specified argument, without
+ * returning a handle. The task cannot be joined; it is waited for by the enclosing finish scope.
+ */
+void argolib_async(fork_t fptr, void *args)
+{
+        argolib_core_async(fptr, args);
+}
+
+/**
+ * Executes a user method with the specified argument as a finish scope: returns only once every
+ * task forked inside the method, and every task those tasks forked in turn, has completed.
+ * No task handles are needed for this. argolib_kernel is a finish scope as well.
+ */
+void argolib_finish(fork_t fptr, void *args)
+{
+        argolib_core_finish(fptr, args);
+}
+
+/**
+ * Runs a finish scope like argolib_finish and records which worker ran each task forked in it.
+ * Tasks are identified by their position in the task tree, so the method must fork the same
+ * tree each time it is run, e.g. one iteration of an iterative kernel.
+ */
+void argolib_record(fork_t fptr, void *args)
+{
+        argolib_core_record(fptr, args);
+}
+
+/**
+ * Runs a finish scope like argolib_finish, pushing every task to the worker that ran it in the
+ * last argolib_record region and with work stealing turned off, so that each worker touches the
+ * same data as in that region. Records instead if nothing was recorded yet, or if ARGOLIB_RANDOMWS
+ * is not 1: the default schedulers always steal. Tasks outside the region, e.g. submitted ones,
+ * are not placed, but they are not stolen either while the region runs.
+ */
+void argolib_replay(fork_t fptr, void *args)
+{
+        argolib_core_replay(fptr, args);
+}
+
+/**
+ * Allocates size bytes, 16 byte aligned, from a bump arena of the calling worker, e.g. for
+ * the argument structs of forked tasks. There is no free: the memory stays valid, on whichever
+ * worker the task runs, until the root scope it was allocated in (the kernel, the outermost
+ * finish scope or the submitted task) has completed, and is then reused. Nested finish scopes
+ * do not release anything, so a long kernel keeps all it allocated until it ends.
+ * Returns NULL outside a kernel or finish scope.
+ */
+void *argolib_alloc(size_t size)
+{
+        return argolib_core_alloc(size);
+}
+
+/**
+ * Initializes a promise: a single assignment variable that tasks created with argolib_async_await
+ * depend on. The promise must outlive every task awaiting it.
+ */
+void argolib_promise_init(Promise *promise)
+{
+        argolib_core_promise_init(promise);
+}
+
+/**
+ * Sets the value of a promise and makes the tasks awaiting it runnable. A task whose last promise
+ * this was is queued on the calling worker. A promise can be put only once: a second put is
+ * reported and leaves the first value in place.
+ */
+void argolib_promise_put(Promise *promise, void *datum)
+{
+        argolib_core_promise_put(promise, datum);
+}
+
+/**
+ * Returns the value of a promise. Only valid once it has been put, e.g. in a task awaiting it;
+ * before that it returns NULL.
+ */
+void *argolib_promise_get(Promise *promise)
+{
+        return promise->datum;
+}
+
+/**
+ * Creates a task that runs the user method with the specified argument once every one of the num
+ * promises has been put. Until then the task only exists as a registration on its promises, so no
+ * ULT waits for them. Like argolib_async, the task is waited for by the enclosing finish scope.
+ */
+void argolib_async_await(fork_t fptr, void *args, Promise **promises, int num)
+{
+        argolib_core_async_await(fptr, args, promises, num);
+}
+
+/**
+ * Submits a user method with the specified argument from any thread, including threads that
+ * Argobots does not know about. Idle workers pick submitted tasks up before they steal.
+ * The method runs as a finish scope. Pass the returned handle to argolib_submit_wait.
+ * Returns NULL, without running the method, if the handle cannot be allocated.
+ * The primary execution stream only runs tasks while the main ULT waits, so a service that keeps
+ * its main thread busy elsewhere should run with ARGOLIB_WORKERS of at least 2.
+ */
+Submit_handle *argolib_submit(fork_t fptr, void *args)
+{
+        return argolib_core_submit(fptr, args);
+}
+
+/**
+ * Blocks the calling thread until a submitted method, and every task it forked, has completed.
+ * Frees the handle.
+ */
+void argolib_submit_wait(Submit_handle *handle)
+{
+        argolib_core_submit_wait(handle);
+}
 
 #endif
@@ -11,6 +11,15 @@
 #include <initializer_list>
 #include <functional>
 #include <type_traits>
+#include <utility>
+#include <new>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstddef>
+#include <cassert>
+#include <atomic>
+#include <mutex>
 
 extern "C"      // Import C style functions 
 {
@@ -24,6 +33,61 @@ void lambda_wrapper(void *arg) {
     delete lambda;
 }
 
+// Calls a lambda which lives on the caller's stack, without taking ownership of it
+template<typename T>
+void lambda_caller(void *arg) {
+    T* lambda = static_cast<T*>(arg);
+    (*lambda)();
+}
+
+// Storage of a task's closure, Offset bytes into the payload of its handle when it fits there.
+// Larger closures come from the runtime's pooled allocator and over-aligned ones from new
+template<typename T, size_t Offset = 0>
+struct task_closure {
+    static const bool in_payload = Offset + sizeof(T) <= ARGOLIB_TASK_PAYLOAD && alignof(T) <= 16;
+    static const bool pooled = !in_payload && alignof(T) <= 16;
+
+    // Moves or copies lambda into its storage and returns the argument to pass to run
+    template<typename L>
+    static void* place(Task_handle* handle, L &&lambda) {
+        if (!in_payload && !pooled)
+            return new T(std::forward<L>(lambda));
+        void* storage = in_payload ? (void *)(handle->payload + Offset) : argolib_core_closure_alloc(sizeof(T));
+        if (!storage)
+            throw std::bad_alloc();
+        return new (storage) T(std::forward<L>(lambda));
+    }
+
+    static void run(void *arg) {
+        (*static_cast<T*>(arg))();
+        discard(arg);
+    }
+
+    // Destroys the closure and gives its storage back, also for a closure that never runs
+    static void discard(void *arg) {
+        T* closure = static_cast<T*>(arg);
+        if (in_payload) {
+            closure->~T();
+        } else if (pooled) {
+            closure->~T();
+            argolib_core_closure_free(closure);
+        } else {
+            delete closure;
+        }
+    }
+};
+
+// Closure of a task forked with argolib::fork_future, along with where its result goes
+template<typename T, typename R>
+struct future_task {
+    T lambda;
+    R* result;
+
+    void operator()() {
+        new (result) R(lambda());
+    }
+};
+
 // using FunctionCallback = std::function<void(void)>;
 // namespace CLambdaWorkaround
 // {
@@ -78,35 +142,368 @@ namespace argolib
         template <typename T>
         void kernel(T &&lambda)
         {
+                // The kernel returns only once lambda is done, so it can stay on our stack
                 typedef typename std::remove_reference<T>::type U;
-                return argolib_core_kernel(lambda_wrapper<U>, new U(lambda));
+                return argolib_core_kernel(lambda_caller<U>, (void *)&lambda);
                 // CLambdaWorkaround::lambda_kernel_wrapper(lambda);			
         }
 
         // Creates a new ULT to run lambda and returns the task handle to the ULT
+        // When lazy task creation decides against a new ULT, runs lambda right away instead
+        // The closure is moved (or copied, if given an lvalue) into the task handle when it fits
         template <typename T>
         Task_handle* fork(T &&lambda)
         {
-                typedef typename std::remove_reference<T>::type U;
-                return argolib_core_fork(lambda_wrapper<U>, new U(lambda));
+                if (argolib_core_fork_inline())
+                {
+                        lambda();
+                        return &argolib_core_inlined_task;
+                }
+
+                typedef typename std::decay<T>::type U;
+                Task_handle* handle = argolib_core_task_create();
+                void* closure = task_closure<U>::place(handle, std::forward<T>(lambda));
+                argolib_core_task_spawn(handle, task_closure<U>::run, closure);
+                return handle;
                 // return CLambdaWorkaround::lambda_fork_wrapper(lambda);			
         }
 
+        // Like fork, but the ULT gets a stack of stack_size bytes instead of the default one
+        template <typename T>
+        Task_handle* fork_stack(size_t stack_size, T &&lambda)
+        {
+                if (argolib_core_fork_inline())
+                {
+                        lambda();
+                        return &argolib_core_inlined_task;
+                }
+
+                typedef typename std::decay<T>::type U;
+                Task_handle* handle = argolib_core_task_create();
+                void* closure = task_closure<U>::place(handle, std::forward<T>(lambda));
+                argolib_core_task_spawn_stack(handle, task_closure<U>::run, closure, stack_size);
+                return handle;
+        }
+
+        // Sets the stack size, in bytes, of the ULTs forked from now on. 0 restores the Argobots default
+        void set_stack_size(size_t stack_size)
+        {
+                argolib_core_set_stack_size(stack_size);
+        }
+
+        // Like fork, but runs lambda as a stackless Argobots tasklet
+        // lambda must not join, use finish or block in any other way
+        template <typename T>
+        Task_handle* fork_leaf(T &&lambda)
+        {
+                if (argolib_core_fork_inline())
+                {
+                        lambda();
+                        return &argolib_core_inlined_task;
+                }
+
+                typedef typename std::decay<T>::type U;
+                Task_handle* handle = argolib_core_task_create();
+                void* closure = task_closure<U>::place(handle, std::forward<T>(lambda));
+                argolib_core_task_spawn_leaf(handle, task_closure<U>::run, closure);
+                return handle;
+        }
+
+        // Result of a task created by fork_future. It can be moved but not copied
+        // The value lives in the task's control block when it fits in ARGOLIB_TASK_PAYLOAD bytes,
+        // in the future itself when the task ran inline, and otherwise in the runtime's pooled
+        // closure storage, or on the heap for a value aligned beyond 16 bytes
+        template <typename R>
+        class future
+        {
+        public:
+                future() : handle(nullptr), result(nullptr) {}
+                future(future &&other) : handle(nullptr), result(nullptr) { take(other); }
+                future(const future &) = delete;
+                future &operator=(const future &) = delete;
+
+                future &operator=(future &&other)
+                {
+                        if (this != &other)
+                        {
+                                reset();
+                                take(other);
+                        }
+                        return *this;
+                }
+
+                // A future which is never read still waits for its task
+                ~future() { reset(); }
+
+                // Tells whether the future still holds a task, i.e. get() has not been called yet
+                bool valid() const { return handle != nullptr; }
+
+                // Joins the task and returns its result. The future is empty afterwards
+                R get()
+                {
+                        argolib_core_task_wait(handle);
+                        R value(std::move(*result));
+                        destroy();
+                        return value;
+                }
+
+        private:
+                template <typename T>
+                friend auto fork_future(T &&lambda) -> future<typename std::decay<decltype(lambda())>::type>;
+
+                static const bool in_payload = sizeof(R) <= ARGOLIB_TASK_PAYLOAD && alignof(R) <= 16;
+                // The closure goes after the result in the payload, on a 16 byte boundary
+                static const size_t closure_offset = in_payload ? (sizeof(R) + 15) / 16 * 16 : 0;
+
+                static const bool pooled = !in_payload && alignof(R) <= 16;
+
+                struct heap_slot
+                {
+                        alignas(R) unsigned char bytes[sizeof(R)];
+                };
+
+                // Storage for a result which does not fit in the payload
+                static R* allocate()
+                {
+                        if (!pooled)
+                                return reinterpret_cast<R*>(new heap_slot);
+                        void* storage = argolib_core_closure_alloc(sizeof(R));
+                        if (!storage)
+                                throw std::bad_alloc();
+                        return static_cast<R*>(storage);
+                }
+
+                bool out_of_line() const
+                {
+                        return !in_payload && handle != &argolib_core_inlined_task;
+                }
+
+                void take(future &other)
+                {
+                        handle = other.handle;
+                        result = other.result;
+                        if (handle == &argolib_core_inlined_task)
+                        {
+                                result = new (local) R(std::move(*other.result));
+                                other.result->~R();
+                        }
+                        other.handle = nullptr;
+                        other.result = nullptr;
+                }
+
+                // Drops the result and the task handle. The task must have completed
+                void destroy()
+                {
+                        result->~R();
+                        if (out_of_line() && pooled)
+                                argolib_core_closure_free(result);
+                        else if (out_of_line())
+                                delete reinterpret_cast<heap_slot*>(result);
+                        argolib_core_task_release(handle);
+                        handle = nullptr;
+                        result = nullptr;
+                }
+
+                void reset()
+                {
+                        if (!handle)
+                                return;
+                        argolib_core_task_wait(handle);
+                        destroy();
+                }
+
+                Task_handle* handle;
+                R* result;
+                alignas(R) unsigned char local[sizeof(R)];
+        };
+
+        // Like fork, but for a lambda which returns a value: the returned future hands it over through get()
+        // Use fork for lambdas which return nothing
+        template <typename T>
+        auto fork_future(T &&lambda) -> future<typename std::decay<decltype(lambda())>::type>
+        {
+                typedef typename std::decay<T>::type U;
+                typedef typename std::decay<decltype(lambda())>::type R;
+                typedef task_closure<future_task<U, R>, future<R>::closure_offset> closure_t;
+
+                future<R> f;
+                if (argolib_core_fork_inline())
+                {
+                        f.handle = &argolib_core_inlined_task;
+                        f.result = new (f.local) R(lambda());
+                        return f;
+                }
+
+                Task_handle* handle = argolib_core_task_create();
+                f.handle = handle;
+                if (future<R>::in_payload)
+                        f.result = reinterpret_cast<R*>(handle->payload);
+                else
+                        f.result = future<R>::allocate();
+                void* closure = closure_t::place(handle, future_task<U, R>{std::forward<T>(lambda), f.result});
+                argolib_core_task_spawn(handle, closure_t::run, closure);
+                return f;
+        }
+
+        // Creates a new ULT to run lambda without a task handle
+        // The task is waited for by the enclosing finish scope instead of a join
+        template <typename T>
+        void async(T &&lambda)
+        {
+                if (argolib_core_fork_inline())
+                {
+                        lambda();
+                        return;
+                }
+
+                typedef typename std::decay<T>::type U;
+                Task_handle* handle = argolib_core_task_create();
+                void* closure = task_closure<U>::place(handle, std::forward<T>(lambda));
+                argolib_core_async_spawn(handle, task_closure<U>::run, closure);
+        }
+
+        // Creates a new ULT to run lambda on worker worker, without a task handle
+        // Unlike async, the task is neither run inline nor stolen before it starts
+        template <typename T>
+        void async_on(int worker, T &&lambda)
+        {
+                typedef typename std::decay<T>::type U;
+                Task_handle* handle = argolib_core_task_create();
+                void* closure = task_closure<U>::place(handle, std::forward<T>(lambda));
+                argolib_core_async_spawn_on(handle, task_closure<U>::run, closure, worker);
+        }
+
+        // Runs lambda and returns once every task forked inside it, transitively, has completed
+        template <typename T>
+        void finish(T &&lambda)
+        {
+                typedef typename std::remove_reference<T>::type U;
+                argolib_core_finish(lambda_caller<U>, (void *)&lambda);
+        }
+
+        // Finish scope recording which worker ran each task, see argolib_record
+        template <typename T>
+        void record(T &&lambda)
+        {
+                typedef typename std::remove_reference<T>::type U;
+                argolib_core_record(lambda_caller<U>, (void *)&lambda);
+        }
+
+        // Finish scope placing each task on the worker recorded for it, see argolib_replay
+        template <typename T>
+        void replay(T &&lambda)
+        {
+                typedef typename std::remove_reference<T>::type U;
+                argolib_core_replay(lambda_caller<U>, (void *)&lambda);
+        }
+
+        // Memory from a bump arena of the calling worker, see argolib_alloc
+        // It is never freed one by one: all of it is reused once the root scope it was allocated in
+        // (kernel, outermost finish or submitted task) has completed, so only trivially destructible
+        // objects belong there. Both functions return nullptr outside any scope or when a chunk cannot
+        // be allocated, and make then constructs nothing
+        struct arena
+        {
+                static void* alloc(size_t size)
+                {
+                        return argolib_core_alloc(size);
+                }
+
+                template <typename T, typename... Args>
+                static T* make(Args &&...args)
+                {
+                        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+                        static_assert(alignof(T) <= 16, "arena memory is 16 byte aligned");
+                        void* storage = alloc(sizeof(T));
+                        if (!storage)
+                                return nullptr;
+                        return new (storage) T(std::forward<Args>(args)...);
+                }
+        };
+
+        // Single assignment variable that tasks created with async_await depend on
+        // It must outlive every task awaiting it
+        template <typename T>
+        class promise
+        {
+        public:
+                promise() { argolib_core_promise_init(&core); }
+                promise(const promise &) = delete;
+                promise &operator=(const promise &) = delete;
+
+                ~promise()
+                {
+                        if (argolib_core_promise_is_put(&core))
+                                reinterpret_cast<T*>(storage)->~T();
+                }
+
+                // Sets the value and makes the tasks awaiting the promise runnable. Call it only once:
+                // a second put is reported and leaves the value alone
+                template <typename U>
+                void put(U &&value)
+                {
+                        if (argolib_core_promise_claim(&core))
+                                argolib_core_promise_put_claimed(&core, new (storage) T(std::forward<U>(value)));
+                }
+
+                // The value. Only valid once put, e.g. in a task awaiting the promise
+                const T &get() const
+                {
+                        return *reinterpret_cast<const T*>(storage);
+                }
+
+                Promise* handle() { return &core; }
+
+        private:
+                Promise core;
+                alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        // Creates a task running lambda once every one of the promises has been put
+        // Until then the task is only registered on the promises: no ULT waits for them.
+        // The task is queued on the worker that puts the last promise and, like async,
+        // is waited for by the enclosing finish scope
+        template <typename T, typename... P>
+        void async_await(T &&lambda, P &...promises)
+        {
+                typedef typename std::decay<T>::type U;
+                // There is no handle yet, so the closure never goes in a payload: an offset past
+                // the end sends it to the pooled allocator
+                typedef task_closure<U, ARGOLIB_TASK_PAYLOAD> closure_t;
+                Promise* list[sizeof...(P) + 1] = {promises.handle()..., nullptr};
+                argolib_core_async_await(closure_t::run, closure_t::place(nullptr, std::forward<T>(lambda)),
+                                         list, sizeof...(P));
+        }
+
+        // Submits lambda from any thread, including ones that are not part of the runtime
+        // such as the request handlers of a server. Wait for it with submit_wait
+        // Returns nullptr, without running lambda, if the handle cannot be allocated
+        template <typename T>
+        Submit_handle* submit(T &&lambda)
+        {
+                typedef typename std::decay<T>::type U;
+                // Like async_await there is no task handle, so the closure goes to the pooled allocator
+                typedef task_closure<U, ARGOLIB_TASK_PAYLOAD> closure_t;
+                void* closure = closure_t::place(nullptr, std::forward<T>(lambda));
+                Submit_handle* handle = argolib_core_submit(closure_t::run, closure);
+                if (!handle)
+                        closure_t::discard(closure);
+                return handle;
+        }
+
+        // Blocks the calling thread until the submitted lambda and every task it forked have completed
+        void submit_wait(Submit_handle* handle)
+        {
+                argolib_core_submit_wait(handle);
+        }
+
         // Called by join to join multiple tasks
         // Takes the input as a initializer list of task handles
         // Finally calls argolib_join on the list of handles
         void join_impl(std::initializer_list<Task_handle*> handles)
         {
-                int size = handles.size();      // Get the number of handles passed
-                Task_handle** list = (Task_handle**)malloc(size * sizeof(Task_handle*));        // Create an array of handles to be passed to argolib
-                
-                // Populate the list by iterating over handles
-                int i = 0;
-                for(Task_handle* th : handles)
-                        list[i++] = th;
-                
-                argolib_core_join(list, size);       // Pass the list and the size to argolib
-                free(list);
+                // The list is only read, so hand the initializer list's own array over to argolib
+                argolib_core_join(const_cast<Task_handle**>(handles.begin()), handles.size());
         }
         
         // Called to join multiple tasks via their task handles
@@ -116,6 +513,330 @@ namespace argolib
         {
                 join_impl({handles...});    // Pass on all the arguments to the join_impl as a initializer list
         }
+
+        // Number of workers (execution streams) of the runtime
+        int num_workers()
+        {
+                return argolib_core_num_workers();
+        }
+
+        // Rank of the calling worker, in [0, num_workers())
+        int worker_id()
+        {
+                return argolib_core_worker_id();
+        }
+
+        // Grain size used by the parallel loops when the user does not give one
+        template<typename Index>
+        Index default_grain(Index begin, Index end)
+        {
+                Index grain = (end - begin) / (64 * num_workers());
+                return grain > 0 ? grain : 1;
+        }
+
+        // Lazy binary splitting: keep running grain sized chunks of the range
+        // and only split off the upper half when the runtime asks for more tasks
+        template<typename Index, typename Body>
+        void parallel_for_impl(Index begin, Index end, Body &body, Index grain)
+        {
+                while (end - begin > grain)
+                {
+                        if (argolib_core_should_split())
+                        {
+                                Index mid = begin + (end - begin) / 2;
+                                Task_handle* task = fork([&]() {
+                                        parallel_for_impl(mid, end, body, grain);
+                                });
+                                parallel_for_impl(begin, mid, body, grain);
+                                join(task);
+                                return;
+                        }
+                        for (Index i = begin; i < begin + grain; i++)
+                                body(i);
+                        begin += grain;
+                }
+                for (Index i = begin; i < end; i++)
+                        body(i);
+        }
+
+        // Calls body(i) for every i in [begin, end) in parallel
+        // The range is split adaptively, never into chunks smaller than grain (0 picks a default)
+        template<typename Index, typename Body>
+        void parallel_for(Index begin, Index end, Body &&body, Index grain = 0)
+        {
+                if (end <= begin)
+                        return;
+                if (grain <= 0)
+                        grain = default_grain(begin, end);
+                parallel_for_impl(begin, end, body, grain);
+        }
+
+        template<typename Index, typename T, typename Body, typename Combine>
+        T parallel_reduce_impl(Index begin, Index end, const T &identity, Body &body, Combine &combine, Index grain)
+        {
+                T result = identity;
+                while (end - begin > grain)
+                {
+                        if (argolib_core_should_split())
+                        {
+                                Index mid = begin + (end - begin) / 2;
+                                T upper = identity;
+                                Task_handle* task = fork([&]() {
+                                        upper = parallel_reduce_impl(mid, end, identity, body, combine, grain);
+                                });
+                                T lower = parallel_reduce_impl(begin, mid, identity, body, combine, grain);
+                                join(task);
+                                return combine(combine(result, lower), upper);
+                        }
+                        for (Index i = begin; i < begin + grain; i++)
+                                result = combine(result, body(i));
+                        begin += grain;
+                }
+                for (Index i = begin; i < end; i++)
+                        result = combine(result, body(i));
+                return result;
+        }
+
+        // Returns identity combined with body(i) for every i in [begin, end), in index order
+        // combine must be associative; the range is split like in parallel_for
+        template<typename Index, typename T, typename Body, typename Combine>
+        T parallel_reduce(Index begin, Index end, const T &identity, Body &&body, Combine &&combine, Index grain = 0)
+        {
+                if (end <= begin)
+                        return identity;
+                if (grain <= 0)
+                        grain = default_grain(begin, end);
+                return parallel_reduce_impl(begin, end, identity, body, combine, grain);
+        }
+
+        // Block block out of num_workers() equal blocks of [begin, end)
+        template<typename Index>
+        Index static_block_begin(Index begin, Index end, int block)
+        {
+                return begin + (Index)((end - begin) * (long long)block / num_workers());
+        }
+
+        // Calls body(i) for every i in [begin, end), the range cut into num_workers() contiguous
+        // blocks of the same size, block w run by worker w. There is no load balancing, but the
+        // same range always lands on the same workers, so loops over data placed by a static loop
+        // before, like the parallel_fill family, find it on their own NUMA node
+        template<typename Index, typename Body>
+        void parallel_for_static(Index begin, Index end, Body &&body)
+        {
+                if (end <= begin)
+                        return;
+                finish([&]() {
+                        for (int w = 0; w < num_workers(); w++)
+                        {
+                                async_on(w, [&, w]() {
+                                        Index last = static_block_begin(begin, end, w + 1);
+                                        for (Index i = static_block_begin(begin, end, w); i < last; i++)
+                                                body(i);
+                                });
+                        }
+                });
+        }
+
+        // Returns identity combined with body(i) for every i in [begin, end), in index order,
+        // with the blocks of parallel_for_static. combine must be associative
+        template<typename Index, typename T, typename Body, typename Combine>
+        T parallel_reduce_static(Index begin, Index end, const T &identity, Body &&body, Combine &&combine)
+        {
+                if (end <= begin)
+                        return identity;
+                std::vector<T> partial(num_workers(), identity);
+                finish([&]() {
+                        for (int w = 0; w < num_workers(); w++)
+                        {
+                                async_on(w, [&, w]() {
+                                        T result = identity;
+                                        Index last = static_block_begin(begin, end, w + 1);
+                                        for (Index i = static_block_begin(begin, end, w); i < last; i++)
+                                                result = combine(result, body(i));
+                                        partial[w] = result;
+                                });
+                        }
+                });
+                T result = identity;
+                for (const T &value : partial)
+                        result = combine(result, value);
+                return result;
+        }
+
+        // Parallel initialization of large arrays. Linux places a page on the NUMA node of the
+        // worker that first writes it, so filling an array from the main thread puts all of it on
+        // one node. These write [first, last) with the blocks of parallel_for_static over
+        // [0, last - first). Only a later parallel_for_static or parallel_reduce_static over the same
+        // number of elements finds every page on the node of the worker touching it; parallel_for,
+        // parallel_reduce and forked tasks go wherever stealing takes them, so for them the pages
+        // are merely spread over the nodes
+        template<typename Iterator, typename T>
+        void parallel_fill(Iterator first, Iterator last, const T &value)
+        {
+                parallel_for_static(std::ptrdiff_t(0), std::ptrdiff_t(last - first), [&](std::ptrdiff_t i) {
+                        first[i] = value;
+                });
+        }
+
+        template<typename InputIterator, typename OutputIterator>
+        void parallel_copy(InputIterator first, InputIterator last, OutputIterator d_first)
+        {
+                parallel_for_static(std::ptrdiff_t(0), std::ptrdiff_t(last - first), [&](std::ptrdiff_t i) {
+                        d_first[i] = first[i];
+                });
+        }
+
+        // Sets first[i] to gen(i). gen is called concurrently, so it must not share state such as rand()
+        template<typename Iterator, typename Generator>
+        void parallel_generate(Iterator first, Iterator last, Generator &&gen)
+        {
+                parallel_for_static(std::ptrdiff_t(0), std::ptrdiff_t(last - first), [&](std::ptrdiff_t i) {
+                        first[i] = gen(i);
+                });
+        }
+
+        // Monoids for reducer: an identity value and an associative, commutative way to fold one
+        // value into another
+        template<typename T>
+        struct sum_monoid
+        {
+                static constexpr bool commutative = true;
+                static T identity() { return T(); }
+                static void reduce(T &left, const T &right) { left += right; }
+        };
+
+        template<typename T>
+        struct min_monoid
+        {
+                static constexpr bool commutative = true;
+                static T identity() { return std::numeric_limits<T>::max(); }
+                static void reduce(T &left, const T &right) { left = std::min(left, right); }
+        };
+
+        template<typename T>
+        struct max_monoid
+        {
+                static constexpr bool commutative = true;
+                static T identity() { return std::numeric_limits<T>::lowest(); }
+                static void reduce(T &left, const T &right) { left = std::max(left, right); }
+        };
+
+        // A variable that any number of tasks fold values into without synchronizing
+        // Every worker updates a view of its own, each on its own cache line. A worker's view
+        // collects the updates of whichever tasks it happens to run, so the monoid must be
+        // commutative and say so with a static constexpr bool commutative = true.
+        // The first update inside a root finish scope (kernel, outermost finish or submitted task)
+        // registers the reducer with it, and the views are merged into the result as soon as that
+        // scope completes. Only one root scope at a time may update a reducer. Updates from threads
+        // outside the runtime go to an extra view under a lock.
+        // The views are sized for the workers when the reducer is constructed, so construct it after
+        // argolib::init, i.e. not as a global or static object
+        template<typename T, typename Monoid = sum_monoid<T>>
+        class reducer
+        {
+                static_assert(Monoid::commutative, "reducer needs a commutative monoid");
+
+        public:
+                reducer() : value(Monoid::identity()), outside(Monoid::identity()), views(num_workers())
+                {
+                        assert(!views.empty() && "reducer constructed before argolib::init");
+                        for (padded_view &view : views)
+                                view.value = Monoid::identity();
+                }
+
+                ~reducer()
+                {
+                        // Destroyed inside the scope it is registered with
+                        if (handle)
+                                argolib_core_at_finish_cancel(handle);
+                }
+
+                reducer(const reducer &) = delete;
+                reducer &operator=(const reducer &) = delete;
+
+                // Folds value into the calling worker's view
+                void update(const T &x)
+                {
+                        if (!registered.load(std::memory_order_relaxed))
+                                enroll();
+                        int id = worker_id();
+                        if (id < 0 || (size_t)id >= views.size())
+                        {
+                                std::lock_guard<std::mutex> guard(outside_lock);
+                                Monoid::reduce(outside, x);
+                                return;
+                        }
+                        Monoid::reduce(views[id].value, x);
+                }
+
+                // The calling worker's view, for tasks only. Do not keep the reference across a join
+                // or finish, the task may go on running on another worker afterwards
+                T &view()
+                {
+                        int id = worker_id();
+                        assert(id >= 0 && "reducer::view called outside the runtime");
+                        return views[id].value;
+                }
+
+                // The result. The views are merged already once the root scope has completed; an
+                // explicit call also merges updates made outside any scope
+                const T &get()
+                {
+                        merge();
+                        return value;
+                }
+
+                // Starts over from the identity
+                void reset()
+                {
+                        merge();
+                        value = Monoid::identity();
+                }
+
+        private:
+                struct alignas(64) padded_view
+                {
+                        T value;
+                };
+
+                // Registers with the root scope of the caller, once per scope
+                void enroll()
+                {
+                        bool expected = false;
+                        if (!registered.compare_exchange_strong(expected, true))
+                                return;
+                        handle = argolib_core_at_finish(merge_views, this);
+                        if (!handle)
+                                registered.store(false);
+                }
+
+                static void merge_views(void *arg)
+                {
+                        reducer *self = static_cast<reducer *>(arg);
+                        self->merge();
+                        self->handle = nullptr;
+                        self->registered.store(false);
+                }
+
+                void merge()
+                {
+                        for (padded_view &view : views)
+                        {
+                                Monoid::reduce(value, view.value);
+                                view.value = Monoid::identity();
+                        }
+                        std::lock_guard<std::mutex> guard(outside_lock);
+                        Monoid::reduce(value, outside);
+                        outside = Monoid::identity();
+                }
+
+                T value;
+                T outside;
+                std::mutex outside_lock;
+                std::vector<padded_view> views;
+                std::atomic<bool> registered{false};
+                void *handle = nullptr;
+        };
 }
 
 #endif
@@ -1,12 +1,27 @@
 #include <argolib_core.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
 
 // Global variables
 ABT_xstream *xstreams;
 ABT_pool *pools;
+ABT_pool *pinnedPools;  // Per worker pools of the tasks only that worker may run
 ABT_sched *scheds;
 
-static void create_pools(int num, ABT_pool *pools);
+static void create_pools(int num, ABT_pool *pools, bool is_deque);
 static void create_scheds(int num, ABT_pool *pools, ABT_sched *scheds);
+static bool pool_take_head(int rank, ABT_thread thread);
+static void finish_scope(fork_t fptr, void *args, int trace_mode);
+
+// States of a Task_handle
+#define TASK_PENDING 0  // Not started yet
+#define TASK_CLAIMED 1  // Started, either by its own ULT or inline by the joiner
 
 /** Creating Pool for Work Stealing Runtime
  *
@@ -15,6 +30,11 @@ static void create_scheds(int num, ABT_pool *pools, ABT_sched *scheds);
 typedef struct unit_t unit_t;
 typedef struct pool_t pool_t;
 
+#define DEQUE_INITIAL_SIZE 1024     // Initial capacity of a lock-free deque. Must be a power of two
+
+typedef struct deque_array_t deque_array_t;
+typedef struct deque_t deque_t;
+
 struct unit_t
 {
         unit_t *p_prev;
@@ -27,60 +47,1309 @@ struct pool_t
         pthread_mutex_t lock;
         unit_t *p_head;
         unit_t *p_tail;
+        int rank;       // Rank of the execution stream owning this pool
+};
+
+// Circular array backing the lock-free deque. Its size is always a power of two
+struct deque_array_t
+{
+        int64_t size;
+        deque_array_t *p_retired; // Array this one replaced. Thieves may still be reading it, so it is freed with the pool
+        unit_t *buffer[];
+};
+
+/** Lock-free Chase-Lev work stealing deque
+ * The owner pushes and pops at the bottom, thieves steal from the top using a CAS.
+ * Pushes coming from other execution streams (e.g. a ULT revived by a remote join)
+ * are parked on the inbound list and moved to the bottom by the owner on its next pop.
+ * Ref: Le et al., Correct and Efficient Work-Stealing for Weak Memory Models, PPoPP 2013
+ */
+struct deque_t
+{
+        int64_t top __attribute__((aligned(64)));       // Written by thieves
+        int64_t bottom __attribute__((aligned(64)));    // Written by the owner only
+        deque_array_t *p_array;
+        int rank;                                       // Rank of the execution stream owning this deque
+        pthread_mutex_t inbound_lock;
+        unit_t *p_inbound;
 };
 
 int num_xstreams;
+bool is_randws = false; // Use the custom work stealing pools and schedulers
+bool is_deque = false;  // Use the lock-free deque instead of the mutex guarded list for the custom pools
+/** Spawning policy
+ * Help-first pushes a new child to the head of the local pool and the parent keeps running.
+ * Work-first switches to the child right away through ABT_thread_create_to; Argobots pushes the
+ * parent to the head of its pool instead, so thieves take parent continuations and the pool
+ * only holds one entry per level of the recursion.
+ */
+typedef enum
+{
+        SPAWN_HELP_FIRST,
+        SPAWN_WORK_FIRST
+} spawn_policy_t;
+
+spawn_policy_t spawn_policy = SPAWN_HELP_FIRST; // ARGOLIB_SPAWN
+
+int lazy_depth = 0;     // Forks run inline once the local pool holds this many tasks, 0 to disable (ARGOLIB_LAZY)
+bool join_take_over_on = true;  // Joins may run an unstarted child on their own stack (ARGOLIB_JOIN_TAKE_OVER)
+
+// Handle returned for the forks that ran inline. Joining it is a no-op
+Task_handle argolib_core_inlined_task = {ABT_THREAD_NULL, NULL, NULL, TASK_CLAIMED, 0, NULL, NULL, 0, 0, {0}};
+
+/** Finish scopes
+ * A finish scope counts the tasks forked inside it, transitively, with a single counter.
+ * Every task remembers the scope it was forked in and runs with that scope as its
+ * current one, so its own children are counted by the same scope. The scope's owner
+ * sleeps on an eventual until the last task checks out.
+ */
+typedef struct finish_t finish_t;
+typedef struct arena_slot_t arena_slot_t;
+typedef struct at_finish_t at_finish_t;
+
+struct finish_t
+{
+        int pending;            // Tasks still running, plus one for the scope body itself
+        ABT_eventual eventual;  // Set by whoever brings pending down to zero
+        finish_t *p_root;       // Outermost scope this one is nested in, itself for a root scope
+        arena_slot_t *p_slots;  // Arena memory of a root scope, one slot per worker, NULL until used
+        at_finish_t *p_at_finish;       // Callbacks to run when a root scope completes, latest first
+        int trace_mode;         // trace_mode_t of the scope, inherited from the outer one
+};
+
+ABT_key finish_key;     // ULT-local pointer to the innermost finish scope
+
+static finish_t *current_finish()
+{
+        void *p_finish = NULL;
+        if (ABT_self_get_specific(finish_key, &p_finish) != ABT_SUCCESS)
+                return NULL;
+        return (finish_t *)p_finish;
+}
+
+// Number of tasks in each worker's pool. Read by thieves, so every counter gets its own cache line
+typedef struct
+{
+        int count;
+} __attribute__((aligned(64))) shared_counter_t;
+
+/** Request channel of the work stealing protocol
+ * Every victim has one request slot which thieves claim with a CAS from -1 to their rank.
+ * The victim takes the request with an exchange and answers through the thief's mailbox,
+ * either with a chain of units or with an explicit rejection when it has nothing left.
+ * A thief that waited longer than steal_timeout_us retracts its request with a CAS back to -1;
+ * if that CAS fails, the victim is already serving it and the answer is on its way.
+ */
+typedef enum
+{
+        REQUEST_NONE,           // No request outstanding
+        REQUEST_PENDING,        // Sent, not answered yet
+        REQUEST_SERVED,         // The mailbox holds the stolen chain
+        REQUEST_REJECTED,       // The victim had nothing to give
+} request_state_t;
+
+typedef struct
+{
+        int requester;          // Rank of the thief, -1 if the slot is free
+} __attribute__((aligned(64))) request_slot_t;
+
+// Chain of units handed over by a victim, oldest first and linked through p_next
+typedef struct
+{
+        unit_t *p_first;
+        unit_t *p_last;
+        int count;
+        int state;              // request_state_t of the owner's request, published last by the victim
+} __attribute__((aligned(64))) mailbox_t;
+
+mailbox_t *mailBox;
+int steal_max = 0;      // Most tasks moved by one steal, 0 for up to half the victim's pool (ARGOLIB_STEAL_MAX)
+int steal_timeout_us = 100;     // Time after which an unanswered request is retracted (ARGOLIB_STEAL_TIMEOUT_US)
+shared_counter_t *sharedCounter;
+request_slot_t *requestBox;
+
+// How a thief picks the workers it sends requests to (ARGOLIB_VICTIM)
+typedef enum
+{
+        VICTIM_RANDOM,          // A fresh random victim on every attempt
+        VICTIM_ROUND_ROBIN,     // Scan all the workers, starting at a random one
+        VICTIM_LAST,            // Scan starting at the last victim which served a task
+        VICTIM_HIERARCHICAL,    // Scan the workers nearest in the topology first, starting at a random one
+} victim_policy_t;
+
+victim_policy_t victim_policy = VICTIM_RANDOM;
+int steal_threshold_max = 16;   // Upper bound of the adaptive steal threshold (ARGOLIB_STEAL_THRESHOLD_MAX)
+
+typedef struct
+{
+        unsigned seed;
+        int threshold;          // Least number of tasks a victim must hold
+        int last_victim;        // -1 if the last request failed
+        int start;              // Offset the current scan started at
+        int pending_victim;     // Victim of the outstanding request
+        double sent_at;         // When the outstanding request was sent
+} __attribute__((aligned(64))) thief_state_t;
+
+thief_state_t *thiefState;
+
+// How execution streams are pinned to CPUs (ARGOLIB_BIND)
+typedef enum
+{
+        BIND_NONE,      // Left to the OS
+        BIND_CORES,     // One worker per core before SMT siblings, filling a NUMA node before the next
+        BIND_SCATTER,   // Round robin over the NUMA nodes
+} bind_policy_t;
+
+bind_policy_t bind_policy = BIND_NONE;
+
+// Distance between two workers in the cache and memory hierarchy, nearest first
+typedef enum
+{
+        TOPO_L2,        // Share an L2 cache
+        TOPO_L3,        // Share an L3 cache
+        TOPO_NODE,      // Same NUMA node
+        TOPO_REMOTE,    // Different NUMA nodes, or not pinned
+        TOPO_LEVELS
+} topo_distance_t;
+
+int *workerCpu;                 // CPU each worker is pinned to, -1 if it is not
+unsigned char *workerDistance;  // topo_distance_t of every pair of workers
+int *victimOrder;               // For every worker the num_xstreams - 1 others, nearest first
+int *victimLevelEnd;            // For every worker and distance, where that distance ends in victimOrder
+
+static inline topo_distance_t worker_distance(int a, int b)
+{
+        return (topo_distance_t)workerDistance[a * num_xstreams + b];
+}
+
+/** Per worker statistics
+ * Every worker only writes to its own entry, and each entry is aligned to a cache line,
+ * so the counters never false share. The entries are only added up in print_stats.
+ * Building with -DARGOLIB_NO_STATS (make release-nostats) compiles all of it out.
+ */
+typedef struct
+{
+        int tasks_created;
+        int net_push;
+        int net_pop;
+        int head_push;
+        int head_pop;
+        int tail_push;
+        int tail_pop;
+        int stolen_from;        // Tasks other workers took from this worker
+        int stole_from;         // Tasks this worker took from the others
+        int mailbox_tasks;      // Tasks received through the mailbox
+        int steals;             // Requests answered with at least one task
+        int steal_requests;     // Requests sent to other workers
+        int steal_failures;     // Requests rejected or retracted
+        int steal_retracts;     // Requests taken back after steal_timeout_us
+        int slab_hits;
+        int slab_misses;
+        int slab_remote_frees;
+        int forks_inlined;      // Forks run on the spot because the local pool was deep enough
+        int forks_leaf;         // Forks created as tasklets
+        int steals_at[TOPO_LEVELS];     // Successful steals by distance to the victim
+        int max_depth;          // Most tasks the worker's own pool held at once
+        int injected;           // Submitted tasks taken from the inject stack
+        int join_taken;         // Joins that ran an unstarted child on the joiner's stack (one switch)
+        int join_done;          // Joins whose child had already finished
+        int join_suspend;       // Joins that had to wait for the child
+        int parks;              // Times the worker went to sleep on its futex
+        double idle_time;       // Seconds spent in the scheduler without work
+} __attribute__((aligned(64))) worker_stats_t;
+
+#ifdef ARGOLIB_NO_STATS
+#define STAT_INC(rank, field) ((void)0)
+#define STAT_ADD(rank, field, value) ((void)sizeof(value))
+#define STAT_INC_REMOTE(rank, field) ((void)0)
+#define STAT_MAX(rank, field, value) ((void)sizeof(value))
+#else
+worker_stats_t *stats;
+// Only for the owner of the entry
+#define STAT_INC(rank, field) (stats[(rank)].field++)
+#define STAT_ADD(rank, field, value) (stats[(rank)].field += (value))
+#define STAT_MAX(rank, field, value) \
+        (stats[(rank)].field = (value) > stats[(rank)].field ? (value) : stats[(rank)].field)
+// For the rare updates made on behalf of another worker, e.g. by a thief
+#define STAT_INC_REMOTE(rank, field) __atomic_fetch_add(&stats[(rank)].field, 1, __ATOMIC_RELAXED)
+#endif
+
+/** Idle policy of the work stealing scheduler
+ * A worker that finds no work first spins with a pause instruction, then gives its core
+ * away with sched_yield, and finally parks on its futex. Parked workers are woken when
+ * their steal request is served or when new work is pushed. The park is bounded by
+ * idle_park_us, so a wakeup lost to a race only costs one timeout.
+ */
+int idle_spin = 1000;   // Failed pops spent spinning (ARGOLIB_IDLE_SPIN)
+int idle_yield = 100;   // Failed pops spent yielding after spinning (ARGOLIB_IDLE_YIELD)
+int idle_park_us = 1000; // Longest park in microseconds (ARGOLIB_IDLE_PARK_US)
+
+typedef struct
+{
+        int futex;      // Bumped by the wakers
+        int parked;
+        int inactive;   // Deactivated by the elastic policy, sleeping until it is given work
+        int pinned;     // Tasks pushed to the worker's pinned pool and not taken yet
+} __attribute__((aligned(64))) idle_state_t;
+
+idle_state_t *idleState;
+int num_parked = 0;
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+}
+
+static void worker_wake(int rank)
+{
+        idle_state_t *p_idle = &idleState[rank];
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&p_idle->parked, __ATOMIC_RELAXED) || __atomic_load_n(&p_idle->inactive, __ATOMIC_RELAXED))
+        {
+                __atomic_fetch_add(&p_idle->futex, 1, __ATOMIC_RELEASE);
+                syscall(SYS_futex, &p_idle->futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        }
+}
+
+// Wakes up one parked worker, if any, so that it can come and steal
+static void worker_wake_any(int rank)
+{
+        for (int k = 1; k <= num_xstreams; k++)
+        {
+                int i = (rank + k) % num_xstreams;
+                if (i != rank && __atomic_load_n(&idleState[i].parked, __ATOMIC_RELAXED) &&
+                    !__atomic_load_n(&idleState[i].inactive, __ATOMIC_RELAXED))
+                {
+                        worker_wake(i);
+                        return;
+                }
+        }
+}
+
+/** Elastic number of active workers
+ * With ARGOLIB_MIN_WORKERS below the number of execution streams, a worker that found no work
+ * for elastic_interval_us deactivates, as long as more than min_active workers are active.
+ * A deactivated worker sleeps on its futex and no longer steals or answers the generic wakeups.
+ * It comes back when a busy worker sees surplus tasks in its pool, when a task is submitted
+ * from outside, or when work is pushed to its own pool. At most max_active workers are woken
+ * up for surplus work; the workers ranked max_active and above start deactivated.
+ * Worker 0 runs the main ULT and always stays active.
+ */
+bool elastic = false;
+int min_active;                 // ARGOLIB_MIN_WORKERS
+int max_active;                 // ARGOLIB_MAX_WORKERS
+int elastic_interval_us = 10000;        // Idle time before deactivating (ARGOLIB_ELASTIC_INTERVAL_US)
+int num_active;
+
+#ifndef ARGOLIB_NO_STATS
+#define ACTIVE_LOG_MAX 4096
+
+typedef struct
+{
+        double time;
+        int active;
+} active_sample_t;
+
+active_sample_t activeLog[ACTIVE_LOG_MAX];      // Every change of num_active
+int active_log_count = 0;
+int active_log_printed = 0;
+double active_log_start;
+#endif
+
+static void active_log(int active)
+{
+#ifndef ARGOLIB_NO_STATS
+        int i = __atomic_fetch_add(&active_log_count, 1, __ATOMIC_RELAXED);
+        if (i < ACTIVE_LOG_MAX)
+        {
+                activeLog[i].time = ABT_get_wtime();
+                activeLog[i].active = active;
+        }
+#else
+        (void)active;
+#endif
+}
+
+// Whether a push has to look for a worker to wake up
+static inline bool workers_sleeping()
+{
+        return __atomic_load_n(&num_parked, __ATOMIC_RELAXED) ||
+               (elastic && __atomic_load_n(&num_active, __ATOMIC_RELAXED) < num_xstreams);
+}
 
-unit_t **mailBox;
-int *sharedCounter;
-int *requestBox;
-bool *requestSent;
-bool *requestServed;
+// Reactivates one deactivated worker, unless max_active workers are active already
+static void worker_activate()
+{
+        for (int i = 1; i < num_xstreams; i++)
+        {
+                if (!__atomic_load_n(&idleState[i].inactive, __ATOMIC_RELAXED))
+                        continue;
+
+                int active = __atomic_load_n(&num_active, __ATOMIC_RELAXED);
+                do
+                {
+                        if (active >= max_active)
+                                return;
+                } while (!__atomic_compare_exchange_n(&num_active, &active, active + 1, true,
+                                                      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+                int expected = 1;
+                if (__atomic_compare_exchange_n(&idleState[i].inactive, &expected, 0, false,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                {
+                        active_log(active + 1);
+                        __atomic_fetch_add(&idleState[i].futex, 1, __ATOMIC_RELEASE);
+                        syscall(SYS_futex, &idleState[i].futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+                        return;
+                }
+                // It woke up on its own meanwhile
+                __atomic_fetch_sub(&num_active, 1, __ATOMIC_RELAXED);
+        }
+}
+
+// Deactivates worker rank unless only min_active workers are left
+static void worker_deactivate(int rank)
+{
+        int active = __atomic_load_n(&num_active, __ATOMIC_RELAXED);
+        while (active > min_active)
+        {
+                if (__atomic_compare_exchange_n(&num_active, &active, active - 1, true,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                {
+                        __atomic_store_n(&idleState[rank].inactive, 1, __ATOMIC_SEQ_CST);
+                        active_log(active - 1);
+                        return;
+                }
+        }
+}
+
+/** Per execution stream slab allocator for pool units, task handles and task closures
+ * Every object carries a small header naming the execution stream that allocated it.
+ * The owner allocates and frees through its local free list without any synchronization.
+ * An object freed on another execution stream is pushed to the owner's remote list with a CAS;
+ * the owner takes the whole remote list over in one exchange once its local list runs dry.
+ * Objects are only given back to malloc in argolib_core_finalize.
+ */
+typedef struct slab_obj_t slab_obj_t;
+typedef struct slab_t slab_t;
+
+struct slab_obj_t
+{
+        slab_obj_t *p_next;
+        int owner;      // Rank of the allocating execution stream, -1 if allocated outside one
+        int size_class; // Only used by the closure allocator
+} __attribute__((aligned(16)));
+
+struct slab_t
+{
+        slab_obj_t *p_local;                            // Owner only
+        slab_obj_t *p_remote __attribute__((aligned(64)));      // Pushed by the other streams
+} __attribute__((aligned(64)));
+
+slab_t *unit_slabs;
+slab_t *handle_slabs;
+
+// Closures too big for a task handle's payload come from power of two size classes,
+// CLOSURE_MIN_SIZE bytes and up. Anything above the last class goes straight to malloc
+#define CLOSURE_MIN_SIZE 128
+#define CLOSURE_CLASSES 5
+slab_t *closure_slabs[CLOSURE_CLASSES];
+
+static slab_t *slab_create(int num)
+{
+        slab_t *slabs = (slab_t *)aligned_alloc(64, sizeof(slab_t) * num);
+        for (int i = 0; i < num; i++)
+        {
+                slabs[i].p_local = NULL;
+                slabs[i].p_remote = NULL;
+        }
+        return slabs;
+}
+
+static void slab_destroy(slab_t *slabs, int num)
+{
+        for (int i = 0; i < num; i++)
+        {
+                slab_obj_t *lists[2] = {slabs[i].p_local, slabs[i].p_remote};
+                for (int j = 0; j < 2; j++)
+                {
+                        while (lists[j])
+                        {
+                                slab_obj_t *p_next = lists[j]->p_next;
+                                free(lists[j]);
+                                lists[j] = p_next;
+                        }
+                }
+        }
+        free(slabs);
+}
+
+static void *slab_alloc(slab_t *slabs, size_t size)
+{
+        int rank = -1;
+        ABT_xstream_self_rank(&rank);   // Leaves rank untouched when not called from an execution stream
+
+        slab_obj_t *p_obj = NULL;
+        if (rank >= 0)
+        {
+                slab_t *p_slab = &slabs[rank];
+                p_obj = p_slab->p_local;
+                if (!p_obj && __atomic_load_n(&p_slab->p_remote, __ATOMIC_RELAXED))
+                        p_obj = __atomic_exchange_n(&p_slab->p_remote, NULL, __ATOMIC_ACQUIRE);
+
+                if (p_obj)
+                {
+                        p_slab->p_local = p_obj->p_next;
+                        STAT_INC(rank, slab_hits);
+                        return (void *)(p_obj + 1);
+                }
+                STAT_INC(rank, slab_misses);
+        }
+
+        p_obj = (slab_obj_t *)malloc(sizeof(slab_obj_t) + size);
+        if (!p_obj)
+                return NULL;
+        p_obj->owner = rank;
+        return (void *)(p_obj + 1);
+}
+
+static void slab_free(slab_t *slabs, void *ptr)
+{
+        slab_obj_t *p_obj = (slab_obj_t *)ptr - 1;
+        if (p_obj->owner < 0)
+        {
+                free(p_obj);
+                return;
+        }
+
+        int rank = -1;
+        ABT_xstream_self_rank(&rank);
+
+        slab_t *p_slab = &slabs[p_obj->owner];
+        if (rank == p_obj->owner)
+        {
+                p_obj->p_next = p_slab->p_local;
+                p_slab->p_local = p_obj;
+                return;
+        }
+
+        // Hand the object back to its owner
+        p_obj->p_next = __atomic_load_n(&p_slab->p_remote, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&p_slab->p_remote, &p_obj->p_next, p_obj, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                ;
+        if (rank >= 0)
+                STAT_INC(rank, slab_remote_frees);
+}
+
+void *argolib_core_closure_alloc(size_t size)
+{
+        int size_class = 0;
+        while (size_class < CLOSURE_CLASSES && size > ((size_t)CLOSURE_MIN_SIZE << size_class))
+                size_class++;
+
+        if (size_class == CLOSURE_CLASSES)
+        {
+                slab_obj_t *p_obj = (slab_obj_t *)malloc(sizeof(slab_obj_t) + size);
+                if (!p_obj)
+                        return NULL;
+                p_obj->owner = -1;
+                p_obj->size_class = size_class;
+                return (void *)(p_obj + 1);
+        }
+
+        void *ptr = slab_alloc(closure_slabs[size_class], (size_t)CLOSURE_MIN_SIZE << size_class);
+        if (ptr)
+                ((slab_obj_t *)ptr - 1)->size_class = size_class;
+        return ptr;
+}
+
+void argolib_core_closure_free(void *ptr)
+{
+        int size_class = ((slab_obj_t *)ptr - 1)->size_class;
+        if (size_class == CLOSURE_CLASSES)
+                free((slab_obj_t *)ptr - 1);
+        else
+                slab_free(closure_slabs[size_class], ptr);
+}
+
+/** ULT stacks
+ * Forked ULTs get their stacks from the runtime instead of Argobots once a stack size is set,
+ * either for all forks (ARGOLIB_STACK_SIZE, argolib_core_set_stack_size) or for one fork.
+ * Every stack is mmap'ed with a guard page below it and a small header at its top, and goes
+ * back to a per execution stream cache when the handle is released, so fork/join cycles keep
+ * reusing stacks whose pages are already mapped in. Only the execution stream a cache belongs
+ * to touches it, so it needs no synchronization.
+ * ULTs created by argolib_core_async free themselves, so they get Argobots allocated stacks.
+ */
+#define STACK_CACHE_MAX 64      // Stacks kept per execution stream, the rest are unmapped
+
+typedef struct stack_hdr_t stack_hdr_t;
+struct stack_hdr_t
+{
+        stack_hdr_t *p_next;
+        size_t size;    // Usable stack size
+        size_t map_size;
+};
+
+typedef struct
+{
+        stack_hdr_t *p_head;
+        int count;
+} __attribute__((aligned(64))) stack_cache_t;
+
+size_t stack_size = 0;          // Stack size of new ULTs, 0 for the Argobots default (ARGOLIB_STACK_SIZE)
+size_t abt_stack_size;          // The Argobots default
+long page_size;
+stack_cache_t *stackCache;
+ABT_thread_attr *stackAttr;     // Per execution stream, only the stack changes between forks
+
+// Per execution stream attribute of async ULTs, which get Argobots allocated stacks. It is only
+// touched again when the stack size changes
+typedef struct
+{
+        ABT_thread_attr attr;
+        size_t stack_size;      // The size attr holds, 0 until first used
+} __attribute__((aligned(64))) async_attr_t;
+
+async_attr_t *asyncAttr;
+
+#ifndef ARGOLIB_NO_STATS
+// Updated with atomics by every execution stream, so only kept when statistics are on
+long live_ults;
+long peak_live_ults;
+long live_stack_bytes;
+long peak_stack_bytes;
+long mapped_stack_bytes;
+
+static void update_peak(long *p_peak, long value)
+{
+        long peak = __atomic_load_n(p_peak, __ATOMIC_RELAXED);
+        while (value > peak && !__atomic_compare_exchange_n(p_peak, &peak, value, true,
+                                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                ;
+}
+
+static void ult_started(size_t size)
+{
+        update_peak(&peak_live_ults, __atomic_add_fetch(&live_ults, 1, __ATOMIC_RELAXED));
+        update_peak(&peak_stack_bytes, __atomic_add_fetch(&live_stack_bytes, (long)size, __ATOMIC_RELAXED));
+}
+
+static void ult_finished(size_t size)
+{
+        __atomic_sub_fetch(&live_ults, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&live_stack_bytes, (long)size, __ATOMIC_RELAXED);
+}
+#else
+#define ult_started(size) ((void)sizeof(size))
+#define ult_finished(size) ((void)sizeof(size))
+#endif
+
+static stack_hdr_t *stack_alloc(int rank, size_t size)
+{
+        stack_cache_t *p_cache = &stackCache[rank];
+        for (stack_hdr_t **pp_hdr = &p_cache->p_head; *pp_hdr; pp_hdr = &(*pp_hdr)->p_next)
+        {
+                if ((*pp_hdr)->size == size)
+                {
+                        stack_hdr_t *p_hdr = *pp_hdr;
+                        *pp_hdr = p_hdr->p_next;
+                        p_cache->count--;
+                        return p_hdr;
+                }
+        }
+
+        // Guard page, the stack rounded up to whole pages, and the header in a page of its own
+        size_t map_size = page_size + (size + page_size - 1) / page_size * page_size + page_size;
+        char *p_base = (char *)mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (p_base == MAP_FAILED)
+                return NULL;
+        mprotect(p_base, page_size, PROT_NONE);
+
+        stack_hdr_t *p_hdr = (stack_hdr_t *)(p_base + map_size - page_size);
+        p_hdr->p_next = NULL;
+        p_hdr->size = size;
+        p_hdr->map_size = map_size;
+#ifndef ARGOLIB_NO_STATS
+        __atomic_add_fetch(&mapped_stack_bytes, (long)map_size, __ATOMIC_RELAXED);
+#endif
+        return p_hdr;
+}
+
+// The stack grows down from its header to the guard page
+static void *stack_addr(stack_hdr_t *p_hdr)
+{
+        return (char *)p_hdr + page_size - p_hdr->map_size + page_size;
+}
+
+static size_t stack_usable(stack_hdr_t *p_hdr)
+{
+        return p_hdr->map_size - 2 * page_size;
+}
+
+static void stack_unmap(stack_hdr_t *p_hdr)
+{
+#ifndef ARGOLIB_NO_STATS
+        __atomic_sub_fetch(&mapped_stack_bytes, (long)p_hdr->map_size, __ATOMIC_RELAXED);
+#endif
+        munmap((char *)p_hdr + page_size - p_hdr->map_size, p_hdr->map_size);
+}
+
+static void stack_free(int rank, stack_hdr_t *p_hdr)
+{
+        stack_cache_t *p_cache = &stackCache[rank];
+        if (p_cache->count >= STACK_CACHE_MAX)
+        {
+                stack_unmap(p_hdr);
+                return;
+        }
+        p_hdr->p_next = p_cache->p_head;
+        p_cache->p_head = p_hdr;
+        p_cache->count++;
+}
+
+void argolib_core_set_stack_size(size_t size)
+{
+        stack_size = size;
+}
+
+size_t argolib_core_get_stack_size()
+{
+        return stack_size ? stack_size : abt_stack_size;
+}
+
+/** Per execution stream bump arenas
+ * argolib_core_alloc hands out memory from 1 MB chunks and never frees it on its own. Every
+ * root finish scope (a kernel, a finish outside any other, a submitted task) gets one slot per
+ * worker the first time a task inside it allocates; a worker bumps through the chunks of its
+ * slot in the current root scope. When the root scope completes, the chunks of all its slots go
+ * back to the workers that took them, so a task stolen by another worker can use what it was
+ * given until its root scope is done, and overlapping root scopes never hold up each other.
+ * Returned chunks are pushed to the owner's returned list with a CAS; the owner takes the whole
+ * list over in one exchange once its free list runs dry.
+ */
+#define ARENA_CHUNK_SIZE (1 << 20)
+
+typedef struct arena_chunk_t arena_chunk_t;
+struct arena_chunk_t
+{
+        arena_chunk_t *p_next;
+        size_t size;
+        char data[] __attribute__((aligned(16)));
+};
+
+struct arena_slot_t
+{
+        arena_chunk_t *p_chunks;        // Chunks taken in this root scope, the current one first
+        size_t used;                    // Bytes taken from p_chunks
+} __attribute__((aligned(64)));
+
+typedef struct
+{
+        arena_chunk_t *p_free;          // Owner only
+        arena_chunk_t *p_returned;      // Pushed by whoever completes a root scope
+        size_t live_bytes;              // Bytes in chunks held by running root scopes
+        size_t high_water;              // Most bytes held at once
+} __attribute__((aligned(64))) arena_t;
+
+arena_t *arenas;
+
+// Takes a chunk of at least size bytes for worker rank
+static arena_chunk_t *arena_chunk_get(int rank, size_t size)
+{
+        arena_t *p_arena = &arenas[rank];
+        if (!p_arena->p_free)
+                p_arena->p_free = __atomic_exchange_n(&p_arena->p_returned, NULL, __ATOMIC_ACQUIRE);
+
+        arena_chunk_t *p_chunk = p_arena->p_free;
+        if (p_chunk && p_chunk->size >= size)
+                p_arena->p_free = p_chunk->p_next;
+        else
+        {
+                size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+                p_chunk = (arena_chunk_t *)malloc(sizeof(arena_chunk_t) + chunk_size);
+                if (!p_chunk)
+                        return NULL;
+                p_chunk->size = chunk_size;
+        }
+
+        size_t live = __atomic_add_fetch(&p_arena->live_bytes, p_chunk->size, __ATOMIC_RELAXED);
+        if (live > p_arena->high_water)
+                p_arena->high_water = live;
+        return p_chunk;
+}
+
+// Gives the chunks of a completed root scope back to the workers that took them
+static void arena_release(finish_t *p_root)
+{
+        if (!p_root->p_slots)
+                return;
+        for (int i = 0; i < num_xstreams; i++)
+        {
+                arena_chunk_t *p_first = p_root->p_slots[i].p_chunks;
+                if (!p_first)
+                        continue;
+                size_t bytes = p_first->size;
+                arena_chunk_t *p_last = p_first;
+                while (p_last->p_next)
+                {
+                        p_last = p_last->p_next;
+                        bytes += p_last->size;
+                }
+                __atomic_sub_fetch(&arenas[i].live_bytes, bytes, __ATOMIC_RELAXED);
+
+                p_last->p_next = __atomic_load_n(&arenas[i].p_returned, __ATOMIC_RELAXED);
+                while (!__atomic_compare_exchange_n(&arenas[i].p_returned, &p_last->p_next, p_first, true,
+                                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                        ;
+        }
+        free(p_root->p_slots);
+}
+
+void *argolib_core_alloc(size_t size)
+{
+        int rank = -1;
+        ABT_xstream_self_rank(&rank);
+        finish_t *p_finish = current_finish();
+        if (rank < 0 || !p_finish)
+                return NULL;
+
+        finish_t *p_root = p_finish->p_root;
+        arena_slot_t *p_slots = __atomic_load_n(&p_root->p_slots, __ATOMIC_ACQUIRE);
+        if (!p_slots)
+        {
+                // First allocation in this root scope, possibly on several workers at once
+                arena_slot_t *p_new = (arena_slot_t *)aligned_alloc(64, sizeof(arena_slot_t) * num_xstreams);
+                if (!p_new)
+                        return NULL;
+                memset(p_new, 0, sizeof(arena_slot_t) * num_xstreams);
+                if (__atomic_compare_exchange_n(&p_root->p_slots, &p_slots, p_new, false,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                        p_slots = p_new;
+                else
+                        free(p_new);
+        }
+
+        // Only the ULTs of this worker touch its slot, and none of them yields in here
+        arena_slot_t *p_slot = &p_slots[rank];
+        size = (size + 15) & ~(size_t)15;
+        if (!p_slot->p_chunks || p_slot->used + size > p_slot->p_chunks->size)
+        {
+                arena_chunk_t *p_chunk = arena_chunk_get(rank, size);
+                if (!p_chunk)
+                        return NULL;
+                p_chunk->p_next = p_slot->p_chunks;
+                p_slot->p_chunks = p_chunk;
+                p_slot->used = 0;
+        }
+
+        void *ptr = p_slot->p_chunks->data + p_slot->used;
+        p_slot->used += size;
+        return ptr;
+}
+
+/** Completion callbacks of root scopes
+ * Any task may hand over a callback to run once its root scope has completed, e.g. to merge the
+ * per worker views of a reducer. The callbacks are pushed with a CAS and run by the scope's
+ * owner after the last task has checked out, so they see every update the tasks made. Cancelling
+ * only clears the arguments: the node stays in the list until the owner frees it.
+ */
+struct at_finish_t
+{
+        fork_t fptr;
+        void *args;             // NULL once cancelled
+        at_finish_t *p_next;
+};
+
+void *argolib_core_at_finish(fork_t fptr, void *args)
+{
+        finish_t *p_finish = current_finish();
+        if (!p_finish)
+                return NULL;
+        at_finish_t *p_node = (at_finish_t *)malloc(sizeof(at_finish_t));
+        if (!p_node)
+                return NULL;
+        p_node->fptr = fptr;
+        p_node->args = args;
+
+        finish_t *p_root = p_finish->p_root;
+        p_node->p_next = __atomic_load_n(&p_root->p_at_finish, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&p_root->p_at_finish, &p_node->p_next, p_node, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                ;
+        return p_node;
+}
+
+void argolib_core_at_finish_cancel(void *handle)
+{
+        __atomic_store_n(&((at_finish_t *)handle)->args, NULL, __ATOMIC_RELAXED);
+}
+
+// Runs the callbacks of a completed root scope, in the order they were registered
+static void at_finish_run(finish_t *p_root)
+{
+        at_finish_t *p_node = __atomic_load_n(&p_root->p_at_finish, __ATOMIC_ACQUIRE);
+        at_finish_t *p_ordered = NULL;
+        while (p_node)
+        {
+                at_finish_t *p_next = p_node->p_next;
+                p_node->p_next = p_ordered;
+                p_ordered = p_node;
+                p_node = p_next;
+        }
+        while (p_ordered)
+        {
+                at_finish_t *p_next = p_ordered->p_next;
+                if (p_ordered->args)
+                        p_ordered->fptr(p_ordered->args);
+                free(p_ordered);
+                p_ordered = p_next;
+        }
+}
+
+/** Trace and replay
+ * In a recording region every task gets an ID made from its parent's ID and its index among the
+ * parent's children, and every worker logs the IDs of the tasks it runs. When the region ends,
+ * the logs are merged into an open addressing table from ID to worker. In a replay region a task
+ * whose ID is in the table is pushed straight to the pool of the worker that ran it, and the
+ * workers do not steal, so each of them keeps working on the same data run after run.
+ * This needs the same task tree every time: in both modes forks never run inline and the loop
+ * templates split every range down to its grain.
+ * The mode is kept in the root scope of the region, so only the tasks of the region are traced.
+ * Stealing is a property of the schedulers though, and stops for everyone while a replay region
+ * runs. The FIFO schedulers cannot stop stealing, so replay needs ARGOLIB_RANDOMWS=1 and records
+ * otherwise.
+ */
+typedef enum
+{
+        TRACE_OFF,
+        TRACE_RECORD,
+        TRACE_REPLAY
+} trace_mode_t;
+
+#define TRACE_ROOT_ID 0x9e3779b97f4a7c15ULL
+
+typedef struct
+{
+        uint64_t id;    // 0 for an empty table slot
+        int rank;
+} trace_entry_t;
+
+typedef struct
+{
+        trace_entry_t *p_entries;
+        int count;
+        int capacity;
+} __attribute__((aligned(64))) trace_log_t;
+
+int traceRegions = 0;   // Record and replay regions running, so untraced programs skip the key lookup
+int replayRegions = 0;  // Replay regions running; the schedulers do not steal while there is one
+ABT_key trace_key;                      // The task handle whose children are being numbered
+trace_log_t *traceLogs;
+trace_entry_t *traceTable = NULL;
+uint64_t trace_mask;
+
+// The mode belongs to the root scope of a region and is inherited by the scopes nested in it,
+// so tasks of other root scopes, such as submitted ones, running at the same time are not traced
+static inline trace_mode_t current_trace_mode()
+{
+        if (__atomic_load_n(&traceRegions, __ATOMIC_RELAXED) == 0)
+                return TRACE_OFF;
+        finish_t *p_finish = current_finish();
+        return p_finish ? (trace_mode_t)p_finish->trace_mode : TRACE_OFF;
+}
+
+// The schedulers run outside of any scope, so they pause stealing for every replay region at once
+static inline bool replay_running()
+{
+        return __atomic_load_n(&replayRegions, __ATOMIC_RELAXED) != 0;
+}
+
+static uint64_t trace_child_id(uint64_t parent, unsigned int index)
+{
+        // splitmix64 finalizer
+        uint64_t z = parent + (index + 1) * 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        return z ? z : 1;
+}
+
+// Gives a new task the next ID among the children of the running task
+static void trace_assign(Task_handle *handle)
+{
+        handle->id = 0;
+        handle->children = 0;
+        if (current_trace_mode() == TRACE_OFF)
+                return;
+
+        void *p_parent = NULL;
+        ABT_self_get_specific(trace_key, &p_parent);
+        if (p_parent)
+        {
+                Task_handle *parent = (Task_handle *)p_parent;
+                handle->id = trace_child_id(parent->id, parent->children++);
+        }
+}
+
+// Pool a new task goes to
+static int trace_target(Task_handle *handle, int rank)
+{
+        if (current_trace_mode() != TRACE_REPLAY || !handle->id || !traceTable)
+                return rank;
+        for (uint64_t i = handle->id & trace_mask;; i = (i + 1) & trace_mask)
+        {
+                if (traceTable[i].id == handle->id)
+                        return traceTable[i].rank;
+                if (traceTable[i].id == 0)
+                        return rank;
+        }
+}
+
+static void trace_log(int rank, uint64_t id)
+{
+        trace_log_t *p_log = &traceLogs[rank];
+        if (p_log->count == p_log->capacity)
+        {
+                p_log->capacity = p_log->capacity ? 2 * p_log->capacity : 1024;
+                p_log->p_entries = (trace_entry_t *)realloc(p_log->p_entries,
+                                                            sizeof(trace_entry_t) * p_log->capacity);
+        }
+        p_log->p_entries[p_log->count].id = id;
+        p_log->p_entries[p_log->count].rank = rank;
+        p_log->count++;
+}
+
+// Merges the logs of the recording region into the table
+static void trace_build()
+{
+        uint64_t total = 0;
+        for (int i = 0; i < num_xstreams; i++)
+                total += traceLogs[i].count;
+        uint64_t size = 1024;
+        while (size < 2 * total)
+                size *= 2;
+
+        free(traceTable);
+        traceTable = (trace_entry_t *)calloc(size, sizeof(trace_entry_t));
+        trace_mask = size - 1;
+        for (int r = 0; r < num_xstreams; r++)
+        {
+                for (int k = 0; k < traceLogs[r].count; k++)
+                {
+                        trace_entry_t *p_entry = &traceLogs[r].p_entries[k];
+                        uint64_t i = p_entry->id & trace_mask;
+                        while (traceTable[i].id != 0 && traceTable[i].id != p_entry->id)
+                                i = (i + 1) & trace_mask;
+                        traceTable[i] = *p_entry;
+                }
+                traceLogs[r].count = 0;
+        }
+}
+
+static void trace_region(trace_mode_t mode, fork_t fptr, void *args)
+{
+        Task_handle root;
+        root.id = TRACE_ROOT_ID;
+        root.children = 0;
+
+        void *p_outer = NULL;
+        ABT_self_get_specific(trace_key, &p_outer);
+        ABT_self_set_specific(trace_key, &root);
+        __atomic_add_fetch(&traceRegions, 1, __ATOMIC_RELAXED);
+        if (mode == TRACE_REPLAY)
+                __atomic_add_fetch(&replayRegions, 1, __ATOMIC_RELAXED);
+        finish_scope(fptr, args, mode);
+        if (mode == TRACE_REPLAY)
+                __atomic_sub_fetch(&replayRegions, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&traceRegions, 1, __ATOMIC_RELAXED);
+        ABT_self_set_specific(trace_key, p_outer);
+}
+
+void argolib_core_record(fork_t fptr, void *args)
+{
+        trace_region(TRACE_RECORD, fptr, args);
+        trace_build();
+}
+
+void argolib_core_replay(fork_t fptr, void *args)
+{
+        // The FIFO schedulers always steal from the other pools, so the placement would not hold
+        if (traceTable && is_randws)
+                trace_region(TRACE_REPLAY, fptr, args);
+        else
+                argolib_core_record(fptr, args);
+}
+
+/** Topology and CPU binding
+ * The cache and NUMA layout is read from /sys/devices/system/cpu. With ARGOLIB_BIND every
+ * execution stream is pinned to one CPU, which gives each pair of workers a distance: sharing
+ * an L2, sharing an L3, same NUMA node or remote. Hierarchical stealing asks the nearest
+ * workers first and only then goes further away.
+ */
+#define TOPO_MAX_NODES 256
+
+typedef struct
+{
+        int cpu;
+        int l2;         // Lowest CPU sharing the L2 cache, the CPU itself if unknown
+        int l3;         // Lowest CPU sharing the L3 cache, -1 if unknown
+        int node;
+        int smt;        // Index among the CPUs sharing the L2, 0 for the first thread of a core
+        int order;      // Sort key of BIND_SCATTER
+} cpu_topo_t;
+
+// Parses a cpulist such as "0-3,8-11". Returns the number of CPUs stored
+static int read_cpulist(const char *path, int *cpus, int max)
+{
+        FILE *fp = fopen(path, "r");
+        if (!fp)
+                return 0;
+        int count = 0;
+        int first, last;
+        while (fscanf(fp, "%d", &first) == 1)
+        {
+                last = first;
+                int c = fgetc(fp);
+                if (c == '-')
+                {
+                        if (fscanf(fp, "%d", &last) != 1)
+                                break;
+                        c = fgetc(fp);
+                }
+                for (int cpu = first; cpu <= last && count < max; cpu++)
+                        cpus[count++] = cpu;
+                if (c != ',')
+                        break;
+        }
+        fclose(fp);
+        return count;
+}
+
+// Lowest CPU sharing the given cache level with cpu, or -1
+static int shared_cache(int cpu, int level, int *buffer, int max)
+{
+        char path[128];
+        for (int index = 0;; index++)
+        {
+                snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+                FILE *fp = fopen(path, "r");
+                if (!fp)
+                        return -1;
+                int found = 0;
+                if (fscanf(fp, "%d", &found) != 1)
+                        found = 0;
+                fclose(fp);
+                if (found != level)
+                        continue;
+                snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+                return read_cpulist(path, buffer, max) ? buffer[0] : -1;
+        }
+}
+
+static int topo_compare(const void *a, const void *b)
+{
+        const cpu_topo_t *x = (const cpu_topo_t *)a;
+        const cpu_topo_t *y = (const cpu_topo_t *)b;
+        int keys_x[] = {x->order, x->smt, x->node, x->l3, x->l2, x->cpu};
+        int keys_y[] = {y->order, y->smt, y->node, y->l3, y->l2, y->cpu};
+        for (int i = 0; i < 6; i++)
+                if (keys_x[i] != keys_y[i])
+                        return keys_x[i] < keys_y[i] ? -1 : 1;
+        return 0;
+}
+
+// Picks a CPU for every worker and orders the victims of every worker by distance
+static void topology_init()
+{
+        int n = num_xstreams;
+        workerCpu = (int *)malloc(sizeof(int) * n);
+        workerDistance = (unsigned char *)malloc(n * n);
+        victimOrder = (int *)malloc(sizeof(int) * n * (n > 1 ? n - 1 : 1));
+        victimLevelEnd = (int *)malloc(sizeof(int) * n * TOPO_LEVELS);
+        for (int i = 0; i < n; i++)
+                workerCpu[i] = -1;
+
+        long max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+        if (max_cpus < 1)
+                max_cpus = 1;
+        int *buffer = (int *)malloc(sizeof(int) * max_cpus);
+        int *online = (int *)malloc(sizeof(int) * max_cpus);
+        int num_cpus = bind_policy != BIND_NONE ? read_cpulist("/sys/devices/system/cpu/online", online, max_cpus) : 0;
+        cpu_topo_t *cpus = (cpu_topo_t *)malloc(sizeof(cpu_topo_t) * (num_cpus ? num_cpus : 1));
+
+        if (num_cpus)
+        {
+                for (int i = 0; i < num_cpus; i++)
+                {
+                        cpus[i].cpu = online[i];
+                        cpus[i].l2 = shared_cache(online[i], 2, buffer, max_cpus);
+                        if (cpus[i].l2 == -1)
+                                cpus[i].l2 = online[i];
+                        cpus[i].l3 = shared_cache(online[i], 3, buffer, max_cpus);
+                        cpus[i].node = 0;
+                        cpus[i].smt = 0;
+                        cpus[i].order = 0;
+                }
+                char path[64];
+                for (int node = 0; node < TOPO_MAX_NODES; node++)
+                {
+                        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+                        int count = read_cpulist(path, buffer, max_cpus);
+                        for (int k = 0; k < count; k++)
+                                for (int i = 0; i < num_cpus; i++)
+                                        if (cpus[i].cpu == buffer[k])
+                                                cpus[i].node = node;
+                }
+                for (int i = 0; i < num_cpus; i++)
+                        for (int j = 0; j < i; j++)
+                                if (cpus[j].l2 == cpus[i].l2)
+                                        cpus[i].smt++;
+
+                // Cores first: node by node, one thread of every core before the SMT siblings
+                qsort(cpus, num_cpus, sizeof(cpu_topo_t), topo_compare);
+                if (bind_policy == BIND_SCATTER)
+                {
+                        // Then deal them out to the nodes in turn, keeping that order within each node
+                        int *seen = (int *)calloc(TOPO_MAX_NODES, sizeof(int));
+                        for (int i = 0; i < num_cpus; i++)
+                                cpus[i].order = seen[cpus[i].node % TOPO_MAX_NODES]++;
+                        free(seen);
+                        qsort(cpus, num_cpus, sizeof(cpu_topo_t), topo_compare);
+                }
+                for (int i = 0; i < n; i++)
+                        workerCpu[i] = cpus[i % num_cpus].cpu;
+        }
 
-pthread_mutex_t pplock;
-int *pool_task; // Task created per pool
-int net_push = 0;
-int net_pop = 0;
+        for (int a = 0; a < n; a++)
+        {
+                for (int b = 0; b < n; b++)
+                {
+                        topo_distance_t distance = TOPO_REMOTE;
+                        if (num_cpus)
+                        {
+                                cpu_topo_t *x = &cpus[a % num_cpus];
+                                cpu_topo_t *y = &cpus[b % num_cpus];
+                                if (x->l2 == y->l2)
+                                        distance = TOPO_L2;
+                                else if (x->l3 != -1 && x->l3 == y->l3)
+                                        distance = TOPO_L3;
+                                else if (x->node == y->node)
+                                        distance = TOPO_NODE;
+                        }
+                        workerDistance[a * n + b] = distance;
+                }
 
-int *pool_net_push;
-int *pool_net_pop;
-int *pool_head_push;
-int *pool_head_pop;
-int *pool_tail_push;
-int *pool_tail_pop;
-int *pool_stolen_from;
-int *pool_stole_from;
+                int count = 0;
+                for (int level = 0; level < TOPO_LEVELS; level++)
+                {
+                        for (int k = 1; k < n; k++)
+                        {
+                                int b = (a + k) % n;
+                                if (worker_distance(a, b) == (topo_distance_t)level)
+                                        victimOrder[a * (n - 1) + count++] = b;
+                        }
+                        victimLevelEnd[a * TOPO_LEVELS + level] = count;
+                }
+        }
 
-int *mailBox_task;
+        free(cpus);
+        free(online);
+        free(buffer);
+}
 
 void print_stats()
 {
-
+#ifndef ARGOLIB_NO_STATS
         int total_task_created = 0;
-        for(int i = 0; i < num_xstreams; i++){
-                total_task_created += pool_task[i];
+        int net_push = 0;
+        int net_pop = 0;
+        int steals = 0;
+        int stolen = 0;
+        int steal_requests = 0;
+        int steal_failures = 0;
+        int inlined = 0;
+        int parks = 0;
+        double idle_time = 0;
+        for (int i = 0; i < num_xstreams; i++)
+        {
+                total_task_created += stats[i].tasks_created;
+                net_push += stats[i].net_push;
+                net_pop += stats[i].net_pop;
+                for (int d = 0; d < TOPO_LEVELS; d++)
+                        steals += stats[i].steals_at[d];
+                stolen += stats[i].stolen_from;
+                steal_requests += stats[i].steal_requests;
+                steal_failures += stats[i].steal_failures;
+                inlined += stats[i].forks_inlined;
+                parks += stats[i].parks;
+                idle_time += stats[i].idle_time;
         }
 
         for (int i = 0; i < num_xstreams; i++)
         {
                 printf("Pool %d\n", i);
-                printf("\tPush Head: %d\tPush Tail: %d\n", pool_head_push[i], pool_tail_push[i]);
-                printf("\tPop Head: %d\tPop Tail: %d\n", pool_head_pop[i], pool_tail_pop[i]);
-                printf("\tStolen From: %d\n", pool_stolen_from[i]);
-                printf("\tPush: %d\tPop: %d\n", pool_net_push[i], pool_net_pop[i]);
+                printf("\tPush Head: %d\tPush Tail: %d\n", stats[i].head_push, stats[i].tail_push);
+                printf("\tPop Head: %d\tPop Tail: %d\n", stats[i].head_pop, stats[i].tail_pop);
+                printf("\tStolen From: %d\tStole: %d\tMailbox: %d\n", stats[i].stolen_from, stats[i].stole_from, stats[i].mailbox_tasks);
+                printf("\tSteal Requests: %d\tFailed Requests: %d\tRetracted: %d\tTasks per Steal: %f\n",
+                       stats[i].steal_requests, stats[i].steal_failures, stats[i].steal_retracts,
+                       stats[i].steals ? (double)stats[i].mailbox_tasks / stats[i].steals : 0.0);
+                printf("\tPush: %d\tPop: %d\n", stats[i].net_push, stats[i].net_pop);
+                printf("\tSlab Hits: %d\tSlab Misses: %d\tRemote Frees: %d\n",
+                       stats[i].slab_hits, stats[i].slab_misses, stats[i].slab_remote_frees);
+                printf("\tIdle Time[ms]: %f\tParks: %d\n", stats[i].idle_time * 1000.0, stats[i].parks);
+                printf("\tForks Inlined: %d\tForks Spawned: %d\tTasklets: %d\n",
+                       stats[i].forks_inlined, stats[i].tasks_created, stats[i].forks_leaf);
+                printf("\tJoins Taken Over: %d\tJoins Finished: %d\tJoins Suspended: %d\n",
+                       stats[i].join_taken, stats[i].join_done, stats[i].join_suspend);
+                printf("\tMax Pool Depth: %d\tInjected: %d\n", stats[i].max_depth, stats[i].injected);
+                printf("\tCPU: %d\tSteals by Distance L2/L3/Node/Remote: %d/%d/%d/%d\n", workerCpu[i],
+                       stats[i].steals_at[TOPO_L2], stats[i].steals_at[TOPO_L3],
+                       stats[i].steals_at[TOPO_NODE], stats[i].steals_at[TOPO_REMOTE]);
+                printf("\tArena Live[KB]: %zu\tArena High Water[KB]: %zu\n",
+                       __atomic_load_n(&arenas[i].live_bytes, __ATOMIC_RELAXED) / 1024, arenas[i].high_water / 1024);
         }
 
         printf("\n");
         printf("Net pushes: %d\n", net_push);
         printf("Net pops: %d\n", net_pop);
         printf("Total Tasks Created: %d\n", total_task_created);
+        // One line of totals since init, for scripts such as tests/bench/bench.sh
+        printf("Counters: tasks=%d steals=%d stolen_tasks=%d steal_requests=%d steal_failures=%d inlined=%d "
+               "parks=%d idle_ms=%.3f\n",
+               total_task_created, steals, stolen, steal_requests, steal_failures, inlined, parks,
+               idle_time * 1000.0);
+        // Argobots allocated stacks count with their full size, whether touched or not
+        printf("Peak Live ULTs: %ld\tPeak Stack Memory[KB]: %ld\tMapped Stacks[KB]: %ld\n",
+               peak_live_ults, peak_stack_bytes / 1024, mapped_stack_bytes / 1024);
+        if (elastic)
+        {
+                // Changes since the last report, as time since init[ms]:active workers
+                int count = __atomic_load_n(&active_log_count, __ATOMIC_RELAXED);
+                if (count > ACTIVE_LOG_MAX)
+                        count = ACTIVE_LOG_MAX;
+                printf("Active Workers: %d (min %d, max %d)\n", __atomic_load_n(&num_active, __ATOMIC_RELAXED),
+                       min_active, max_active);
+                for (int i = active_log_printed; i < count; i++)
+                        printf("%.3f:%d%c", (activeLog[i].time - active_log_start) * 1000.0, activeLog[i].active,
+                               (i + 1 - active_log_printed) % 8 == 0 || i + 1 == count ? '\n' : '\t');
+                active_log_printed = count;
+        }
+#endif
 }
 
 void print_shared_counter(){
         printf("Shared Counters: \n");
         for (int i = 0; i < num_xstreams; i++)
         {
-                printf("%d: %d\t", i, sharedCounter[i]);
+                printf("%d: %d\t", i, sharedCounter[i].count);
         }
         printf("\n");
 }
@@ -89,55 +1358,151 @@ void argolib_core_init(int argc, char **argv)
 {
         char *workers = getenv("ARGOLIB_WORKERS");
         char *randomws = getenv("ARGOLIB_RANDOMWS");
+        char *deque = getenv("ARGOLIB_DEQUE");
+        char *spin = getenv("ARGOLIB_IDLE_SPIN");
+        char *yield = getenv("ARGOLIB_IDLE_YIELD");
+        char *park = getenv("ARGOLIB_IDLE_PARK_US");
+        char *victim = getenv("ARGOLIB_VICTIM");
+        char *threshold_max = getenv("ARGOLIB_STEAL_THRESHOLD_MAX");
+        char *max_steal = getenv("ARGOLIB_STEAL_MAX");
+        char *steal_timeout = getenv("ARGOLIB_STEAL_TIMEOUT_US");
+        char *lazy = getenv("ARGOLIB_LAZY");
+        char *stack = getenv("ARGOLIB_STACK_SIZE");
+        char *spawn = getenv("ARGOLIB_SPAWN");
+        char *bind = getenv("ARGOLIB_BIND");
+        char *min_workers = getenv("ARGOLIB_MIN_WORKERS");
+        char *max_workers = getenv("ARGOLIB_MAX_WORKERS");
+        char *interval = getenv("ARGOLIB_ELASTIC_INTERVAL_US");
+        char *take_over = getenv("ARGOLIB_JOIN_TAKE_OVER");
 
         num_xstreams = workers ? atoi(workers) : 1;
-        bool is_randws = randomws ? (atoi(randomws) > 0 ? 1 : 0) : 0;
-
-        pthread_mutex_init(&pplock, 0);
-        pool_net_push = (int *)calloc(num_xstreams, sizeof(int));
-        pool_net_pop = (int *)calloc(num_xstreams, sizeof(int));
-        pool_head_push = (int *)calloc(num_xstreams, sizeof(int));
-        pool_head_pop = (int *)calloc(num_xstreams, sizeof(int));
-        pool_tail_push = (int *)calloc(num_xstreams, sizeof(int));
-        pool_tail_pop = (int *)calloc(num_xstreams, sizeof(int));
-        pool_stolen_from = (int *)calloc(num_xstreams, sizeof(int));
-        pool_stole_from = (int *)calloc(num_xstreams, sizeof(int));
-
-        pool_task = (int *)calloc(num_xstreams, sizeof(int));
-
-        mailBox_task = (int *)calloc(num_xstreams, sizeof(int));
+        is_randws = randomws ? (atoi(randomws) > 0 ? 1 : 0) : 0;
+        is_deque = deque ? (atoi(deque) > 0 ? 1 : 0) : 0;
+        idle_spin = spin ? atoi(spin) : idle_spin;
+        idle_yield = yield ? atoi(yield) : idle_yield;
+        idle_park_us = park ? atoi(park) : idle_park_us;
+        if (idle_park_us <= 0)
+                idle_park_us = 1;
+        if (bind && strcmp(bind, "cores") == 0)
+                bind_policy = BIND_CORES;
+        else if (bind && strcmp(bind, "scatter") == 0)
+                bind_policy = BIND_SCATTER;
+        else
+                bind_policy = BIND_NONE;
+        if (victim && strcmp(victim, "roundrobin") == 0)
+                victim_policy = VICTIM_ROUND_ROBIN;
+        else if (victim && strcmp(victim, "last") == 0)
+                victim_policy = VICTIM_LAST;
+        else if ((victim && strcmp(victim, "hierarchical") == 0) || (!victim && bind_policy != BIND_NONE))
+                victim_policy = VICTIM_HIERARCHICAL;
+        else
+                victim_policy = VICTIM_RANDOM;
+        steal_threshold_max = threshold_max ? atoi(threshold_max) : steal_threshold_max;
+        if (steal_threshold_max < 1)
+                steal_threshold_max = 1;
+        steal_max = max_steal ? atoi(max_steal) : steal_max;
+        steal_timeout_us = steal_timeout ? atoi(steal_timeout) : steal_timeout_us;
+        lazy_depth = lazy ? atoi(lazy) : lazy_depth;
+        join_take_over_on = take_over ? atoi(take_over) > 0 : join_take_over_on;
+        spawn_policy = spawn && strcmp(spawn, "workfirst") == 0 ? SPAWN_WORK_FIRST : SPAWN_HELP_FIRST;
+        stack_size = stack && atol(stack) > 0 ? (size_t)atol(stack) : stack_size;
+        page_size = sysconf(_SC_PAGESIZE);
 
         // Minimum size Execution Streams and Threads when taken from user
         if (num_xstreams <= 0)
                 num_xstreams = 1;
 
+        max_active = max_workers ? atoi(max_workers) : num_xstreams;
+        if (max_active < 1 || max_active > num_xstreams)
+                max_active = num_xstreams;
+        min_active = min_workers ? atoi(min_workers) : max_active;
+        if (min_active < 1)
+                min_active = 1;
+        if (min_active > max_active)
+                min_active = max_active;
+        elastic_interval_us = interval ? atoi(interval) : elastic_interval_us;
+        if (elastic_interval_us <= 0)
+                elastic_interval_us = 1;
+        // Only the custom schedulers can deactivate
+        elastic = is_randws && min_active < num_xstreams;
+        num_active = elastic ? max_active : num_xstreams;
+
+        // Units are created as soon as the primary ULT is pushed to its pool, so the slabs come first
+#ifndef ARGOLIB_NO_STATS
+        stats = (worker_stats_t *)aligned_alloc(64, sizeof(worker_stats_t) * num_xstreams);
+        memset(stats, 0, sizeof(worker_stats_t) * num_xstreams);
+#endif
+        topology_init();
+        unit_slabs = slab_create(num_xstreams);
+        handle_slabs = slab_create(num_xstreams);
+        for (int i = 0; i < CLOSURE_CLASSES; i++)
+                closure_slabs[i] = slab_create(num_xstreams);
+
         xstreams = (ABT_xstream *)malloc(sizeof(ABT_xstream) * num_xstreams);
         pools = (ABT_pool *)malloc(sizeof(ABT_pool) * num_xstreams);
+        pinnedPools = (ABT_pool *)malloc(sizeof(ABT_pool) * num_xstreams);
         scheds = (ABT_sched *)malloc(sizeof(ABT_sched) * num_xstreams);
 
-        mailBox = (unit_t **)malloc(sizeof(unit_t*) * num_xstreams);
-        sharedCounter = (int *)calloc(num_xstreams, sizeof(int));
-        requestBox = (int *)calloc(num_xstreams, sizeof(int));
-        requestSent = (bool *)calloc(num_xstreams, sizeof(bool));
-        requestServed = (bool *)calloc(num_xstreams, sizeof(bool));
+        mailBox = (mailbox_t *)aligned_alloc(64, sizeof(mailbox_t) * num_xstreams);
+        sharedCounter = (shared_counter_t *)aligned_alloc(64, sizeof(shared_counter_t) * num_xstreams);
+        requestBox = (request_slot_t *)aligned_alloc(64, sizeof(request_slot_t) * num_xstreams);
+        idleState = (idle_state_t *)aligned_alloc(64, sizeof(idle_state_t) * num_xstreams);
+        thiefState = (thief_state_t *)aligned_alloc(64, sizeof(thief_state_t) * num_xstreams);
+        stackCache = (stack_cache_t *)aligned_alloc(64, sizeof(stack_cache_t) * num_xstreams);
+        stackAttr = (ABT_thread_attr *)malloc(sizeof(ABT_thread_attr) * num_xstreams);
+        asyncAttr = (async_attr_t *)aligned_alloc(64, sizeof(async_attr_t) * num_xstreams);
+        arenas = (arena_t *)aligned_alloc(64, sizeof(arena_t) * num_xstreams);
+        traceLogs = (trace_log_t *)aligned_alloc(64, sizeof(trace_log_t) * num_xstreams);
+        memset(traceLogs, 0, sizeof(trace_log_t) * num_xstreams);
+        memset(arenas, 0, sizeof(arena_t) * num_xstreams);
 
         for (int i = 0; i < num_xstreams; i++)
         {
-                requestBox[i] = -1; // Initialize Request Box IDs with -1
-                mailBox[i] = NULL;
-                requestSent[i] = false;
-                requestServed[i] = false;
+                idleState[i].futex = 0;
+                idleState[i].parked = 0;
+                idleState[i].inactive = elastic && i >= max_active;
+                idleState[i].pinned = 0;
+                thiefState[i].seed = (unsigned)time(NULL) + i;
+                thiefState[i].threshold = 1;
+                thiefState[i].last_victim = -1;
+                thiefState[i].start = 0;
+                thiefState[i].pending_victim = -1;
+                thiefState[i].sent_at = 0;
+                sharedCounter[i].count = 0;
+                requestBox[i].requester = -1; // Initialize Request Box IDs with -1
+                mailBox[i].p_first = NULL;
+                mailBox[i].p_last = NULL;
+                mailBox[i].count = 0;
+                mailBox[i].state = REQUEST_NONE;
+                stackCache[i].p_head = NULL;
+                stackCache[i].count = 0;
         }
 
         ABT_init(argc, argv);
+#ifndef ARGOLIB_NO_STATS
+        active_log_start = ABT_get_wtime();
+#endif
+        if (elastic)
+                active_log(num_active);
+        ABT_key_create(NULL, &finish_key);
+        ABT_key_create(NULL, &trace_key);
+        ABT_info_query_config(ABT_INFO_QUERY_KIND_DEFAULT_THREAD_STACKSIZE, &abt_stack_size);
+        for (int i = 0; i < num_xstreams; i++)
+        {
+                ABT_thread_attr_create(&stackAttr[i]);
+                ABT_thread_attr_create(&asyncAttr[i].attr);
+                asyncAttr[i].stack_size = 0;
+        }
 
         /* Set up a primary execution stream. */
         ABT_xstream_self(&xstreams[0]);
+        if (workerCpu[0] != -1)
+                ABT_xstream_set_cpubind(xstreams[0], workerCpu[0]);
 
         /* Create pools. */
 
         if (is_randws)
-                create_pools(num_xstreams, pools);
+                create_pools(num_xstreams, pools, is_deque);
         else
         {
                 for (int i = 0; i < num_xstreams; i++)
@@ -155,6 +1520,12 @@ void argolib_core_init(int argc, char **argv)
                 }
         }
 
+        // The work stealing scheduler takes from its pinned pool itself; the default one is
+        // handed it as its first pool, so it looks there before anywhere else
+        for (int i = 0; i < num_xstreams; i++)
+                ABT_pool_create_basic(ABT_POOL_FIFO, ABT_POOL_ACCESS_MPMC, is_randws ? ABT_FALSE : ABT_TRUE,
+                                      &pinnedPools[i]);
+
         /* Create schedulers. */
         if (is_randws)
                 create_scheds(num_xstreams, pools, scheds);
@@ -162,13 +1533,14 @@ void argolib_core_init(int argc, char **argv)
         {
                 for (int i = 0; i < num_xstreams; i++)
                 {
-                        ABT_pool *tmp = (ABT_pool *)malloc(sizeof(ABT_pool) * num_xstreams);
+                        ABT_pool *tmp = (ABT_pool *)malloc(sizeof(ABT_pool) * (num_xstreams + 1));
+                        tmp[0] = pinnedPools[i];
                         for (int j = 0; j < num_xstreams; j++)
                         {
-                                tmp[j] = pools[(i + j) % num_xstreams];
+                                tmp[j + 1] = pools[(i + j) % num_xstreams];
                         }
                         //?Difference between ABT_POOL_RANDWS and ABT_SCHED_RANDWS?
-                        ABT_sched_create_basic(ABT_SCHED_DEFAULT, num_xstreams, tmp,
+                        ABT_sched_create_basic(ABT_SCHED_DEFAULT, num_xstreams + 1, tmp,
                                                ABT_SCHED_CONFIG_NULL, &scheds[i]);
                         free(tmp);
                 }
@@ -181,66 +1553,697 @@ void argolib_core_init(int argc, char **argv)
         for (int i = 1; i < num_xstreams; i++)
         {
                 ABT_xstream_create(scheds[i], &xstreams[i]);
+                if (workerCpu[i] != -1)
+                        ABT_xstream_set_cpubind(xstreams[i], workerCpu[i]);
+        }
+}
+
+// Registers a new task with the innermost finish scope, which is returned
+static finish_t *finish_enter()
+{
+        finish_t *p_finish = current_finish();
+        if (p_finish)
+                __atomic_fetch_add(&p_finish->pending, 1, __ATOMIC_RELAXED);
+        return p_finish;
+}
+
+static void finish_leave(finish_t *p_finish)
+{
+        if (p_finish && __atomic_sub_fetch(&p_finish->pending, 1, __ATOMIC_ACQ_REL) == 0)
+                ABT_eventual_set(p_finish->eventual, NULL, 0);
+}
+
+// Runs a claimed task inside the finish scope it was forked in
+static void task_execute(Task_handle *handle)
+{
+        finish_t *p_finish = (finish_t *)handle->finish;        // The handle may be gone once fptr returns
+        void *p_outer = NULL;
+        ABT_self_get_specific(finish_key, &p_outer);
+        ABT_self_set_specific(finish_key, p_finish);
+        if (handle->id)
+        {
+                // Traced task: log where it runs and number its children
+                void *p_parent = NULL;
+                ABT_self_get_specific(trace_key, &p_parent);
+                if (current_trace_mode() == TRACE_RECORD)
+                {
+                        int rank;
+                        ABT_xstream_self_rank(&rank);
+                        trace_log(rank, handle->id);
+                }
+                ABT_self_set_specific(trace_key, handle);
+                handle->fptr(handle->args);
+                ABT_self_set_specific(trace_key, p_parent);
+        }
+        else
+                handle->fptr(handle->args);
+        ABT_self_set_specific(finish_key, p_outer);
+        finish_leave(p_finish);
+}
+
+// Body of every forked ULT. Does nothing if the joiner already ran the task inline
+static void task_run(void *arg)
+{
+        Task_handle *handle = (Task_handle *)arg;
+        int expected = TASK_PENDING;
+        if (__atomic_compare_exchange_n(&handle->state, &expected, TASK_CLAIMED, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                task_execute(handle);
+        if (handle->stack_size)     // Not a tasklet
+                ult_finished(handle->stack_size);
+}
+
+// Body of the ULTs created by argolib_core_async. Nobody joins them, so they clean up after themselves
+static void async_run(void *arg)
+{
+        Task_handle *handle = (Task_handle *)arg;
+        size_t size = handle->stack_size;
+        task_execute(handle);
+        slab_free(handle_slabs, handle);
+        ult_finished(size);
+}
+
+// Number of tasks in the pool of worker rank, and whether a thief is waiting on it
+static void local_load(int rank, int *depth, bool *thief_waiting)
+{
+        if (is_deque)
+        {
+                // Thieves take from the deques directly, so only the sleeping ones are known to wait
+                deque_t *p_deque;
+                ABT_pool_get_data(pools[rank], (void **)&p_deque);
+                *depth = (int)(__atomic_load_n(&p_deque->bottom, __ATOMIC_RELAXED) -
+                               __atomic_load_n(&p_deque->top, __ATOMIC_RELAXED));
+                *thief_waiting = __atomic_load_n(&num_parked, __ATOMIC_RELAXED) > 0;
+        }
+        else
+        {
+                *depth = sharedCounter[rank].count;
+                *thief_waiting = __atomic_load_n(&requestBox[rank].requester, __ATOMIC_RELAXED) != -1;
+        }
+}
+
+/** Lazy task creation
+ * Once the local pool holds lazy_depth tasks there is enough work around for the thieves,
+ * so further forks run on the spot unless a thief is waiting for work right now.
+ */
+int argolib_core_fork_inline()
+{
+        if (lazy_depth <= 0 || !is_randws || current_trace_mode() != TRACE_OFF)
+                return 0;
+
+        int rank = -1;
+        ABT_xstream_self_rank(&rank);
+        if (rank < 0)
+                return 0;
+
+        int depth;
+        bool thief_waiting;
+        local_load(rank, &depth, &thief_waiting);
+        if (depth < lazy_depth || thief_waiting)
+                return 0;
+        STAT_INC(rank, forks_inlined);
+        return 1;
+}
+
+/** Adaptive range splitting
+ * A range is worth splitting when this worker has nothing left for the thieves to take,
+ * or when a thief is asking for work. The default Argobots pools give no such hints,
+ * so there every range is split down to its grain size.
+ */
+int argolib_core_should_split()
+{
+        int rank = -1;
+        ABT_xstream_self_rank(&rank);
+        if (!is_randws || rank < 0 || current_trace_mode() != TRACE_OFF)
+                return 1;
+
+        int depth;
+        bool thief_waiting;
+        local_load(rank, &depth, &thief_waiting);
+        return depth == 0 || thief_waiting;
+}
+
+int argolib_core_num_workers()
+{
+        return num_xstreams;
+}
+
+int argolib_core_worker_id()
+{
+        int rank = -1;
+        ABT_xstream_self_rank(&rank);
+        return rank;
+}
+
+Task_handle *argolib_core_task_create()
+{
+        return (Task_handle *)slab_alloc(handle_slabs, sizeof(Task_handle));
+}
+
+static void task_init(Task_handle *handle, fork_t fptr, void *args)
+{
+        handle->fptr = fptr;
+        handle->args = args;
+        handle->state = TASK_PENDING;
+        handle->finish = finish_enter();
+        trace_assign(handle);
+}
+
+// Creates the ULT of a handle with a stack of the given size, 0 for the Argobots default
+static void thread_spawn(Task_handle *handle, size_t size)
+{
+        int rank;
+        ABT_xstream_self_rank(&rank); // Gets the pool index of the calling pool
+        int target = trace_target(handle, rank);
+        ABT_pool target_pool = pools[target];
+
+        ABT_thread_attr attr = ABT_THREAD_ATTR_NULL;
+        handle->stack = NULL;
+        handle->stack_size = abt_stack_size;
+        stack_hdr_t *p_hdr = size ? stack_alloc(rank, size) : NULL;
+        if (p_hdr)
+        {
+                handle->stack = p_hdr;
+                handle->stack_size = stack_usable(p_hdr);
+                attr = stackAttr[rank];
+                ABT_thread_attr_set_stack(attr, stack_addr(p_hdr), handle->stack_size);
         }
+        ult_started(handle->stack_size);
+        STAT_INC(rank, tasks_created);  // Before creating: under work-first the parent may resume on another worker
+
+        // printf("Forked from ES %d\n", rank);
+        // Work-first needs a ULT to switch away from; a tasklet forking stays help-first
+        ABT_unit_type type = ABT_UNIT_TYPE_THREAD;
+        if (spawn_policy == SPAWN_WORK_FIRST)
+                ABT_self_get_type(&type);
+        if (spawn_policy == SPAWN_WORK_FIRST && type == ABT_UNIT_TYPE_THREAD && target == rank)
+                ABT_thread_create_to(target_pool, task_run, handle, attr, &handle->thread);
+        else
+                ABT_thread_create(target_pool, task_run, handle, attr, &handle->thread);
+}
+
+void argolib_core_task_spawn(Task_handle *handle, fork_t fptr, void *args)
+{
+        task_init(handle, fptr, args);
+        thread_spawn(handle, stack_size);
+}
+
+void argolib_core_task_spawn_stack(Task_handle *handle, fork_t fptr, void *args, size_t size)
+{
+        task_init(handle, fptr, args);
+        thread_spawn(handle, size ? size : stack_size);
 }
 
 Task_handle *argolib_core_fork(fork_t fptr, void *args)
 {
+        if (argolib_core_fork_inline())
+        {
+                fptr(args);
+                return &argolib_core_inlined_task;
+        }
+
         /** Create ULTs.
          * The pool associated with this thread is same as the pool of the caller.
          * thread_pointer will be returned to the caller hence defined static.
          * Preferably, the caller should pass a thread_arg_t pointer
          */
-        Task_handle *thread_pointer = (Task_handle *)malloc(sizeof(Task_handle));
+        Task_handle *thread_pointer = argolib_core_task_create();
+        argolib_core_task_spawn(thread_pointer, fptr, args);
+        return thread_pointer;
+}
+
+Task_handle *argolib_core_fork_stack(fork_t fptr, void *args, size_t stack_size)
+{
+        if (argolib_core_fork_inline())
+        {
+                fptr(args);
+                return &argolib_core_inlined_task;
+        }
+
+        Task_handle *handle = argolib_core_task_create();
+        argolib_core_task_spawn_stack(handle, fptr, args, stack_size);
+        return handle;
+}
+
+/** Leaf tasks
+ * A tasklet has no stack of its own; it runs on the stack of the scheduler that picks it up
+ * and is never suspended. It goes through the same pools, steals and joins as a ULT, but the
+ * task must not join, wait on a finish scope or otherwise block.
+ */
+void argolib_core_task_spawn_leaf(Task_handle *handle, fork_t fptr, void *args)
+{
+        task_init(handle, fptr, args);
+        handle->stack = NULL;
+        handle->stack_size = 0;
 
         int rank;
-        ABT_xstream_self_rank(&rank); // Gets the pool index of the calling pool
-        ABT_pool target_pool = pools[rank];
-        // printf("Forked from ES %d\n", rank);
-        //  When should we use ABT_thread_create_to ?
-        //  This internally pushes the thread into the pool
-        ABT_thread_create(target_pool, fptr, args,
-                          ABT_THREAD_ATTR_NULL, thread_pointer);
+        ABT_xstream_self_rank(&rank);
+        ABT_task_create(pools[trace_target(handle, rank)], task_run, handle, &handle->thread);
+
+        STAT_INC(rank, tasks_created);
+        STAT_INC(rank, forks_leaf);
+}
+
+Task_handle *argolib_core_fork_leaf(fork_t fptr, void *args)
+{
+        if (argolib_core_fork_inline())
+        {
+                fptr(args);
+                return &argolib_core_inlined_task;
+        }
 
-        pool_task[rank]++;
+        Task_handle *handle = argolib_core_task_create();
+        argolib_core_task_spawn_leaf(handle, fptr, args);
+        return handle;
+}
 
-        return thread_pointer;
+/** Join fast path
+ * If the child has not been stolen and still sits at the head of the joiner's own pool,
+ * take it out of the pool and run its function directly on the joiner's stack.
+ * The emptied ULT is then scheduled once so that Argobots sees it terminate;
+ * its body returns immediately as the task is already claimed. Argobots cannot drop a ULT
+ * without running it, so this still costs a switch into that ULT and back. What it saves is
+ * running the child on a stack of its own and the joiner's trip through the scheduler.
+ */
+static bool join_take_over(int rank, Task_handle *handle)
+{
+        if (!is_randws || !join_take_over_on || __atomic_load_n(&handle->state, __ATOMIC_RELAXED) != TASK_PENDING)
+                return false;
+        if (!pool_take_head(rank, handle->thread))
+                return false;
+
+        int expected = TASK_PENDING;
+        if (__atomic_compare_exchange_n(&handle->state, &expected, TASK_CLAIMED, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                task_execute(handle);
+
+        ABT_self_schedule(handle->thread, ABT_POOL_NULL);
+        return true;
+}
+
+static void task_wait(Task_handle *handle)
+{
+        // Read for every task: after suspending on the previous one, the joiner may have been
+        // resumed by another worker
+        int rank;
+        ABT_xstream_self_rank(&rank);
+        if (join_take_over(rank, handle))
+        {
+                STAT_INC(rank, join_taken);
+                return;
+        }
+
+        ABT_thread_state state;
+        ABT_thread_get_state(handle->thread, &state);
+        if (state == ABT_THREAD_STATE_TERMINATED)
+                STAT_INC(rank, join_done);
+        else
+                STAT_INC(rank, join_suspend);
+        ABT_thread_join(handle->thread);
+}
+
+void argolib_core_task_wait(Task_handle *handle)
+{
+        if (handle != &argolib_core_inlined_task)
+                task_wait(handle);
+}
+
+void argolib_core_task_release(Task_handle *handle)
+{
+        if (handle == &argolib_core_inlined_task)
+                return;
+
+        ABT_thread_free(&handle->thread);
+        if (handle->stack)
+        {
+                int rank;
+                ABT_xstream_self_rank(&rank);
+                stack_free(rank, (stack_hdr_t *)handle->stack);
+        }
+        slab_free(handle_slabs, handle);
 }
 
 void argolib_core_join(Task_handle **list, int size)
 {
-        // First join all the threads
-        // ABT_thread_join might not be needed. Confirm!
-        for (int i = 0; i < size; i++)
+        // First join all the threads. The last forked child is the most likely
+        // to still be at the head of our pool, so go backwards
+        for (int i = size - 1; i >= 0; i--)
         {
-                ABT_thread_join((*list[i]));
+                if (list[i] != &argolib_core_inlined_task)
+                        task_wait(list[i]);
         }
 
-        // Free all the threads
+        // Free all the threads and the thread pointers allocated in fork
         for (int i = 0; i < size; i++)
+                argolib_core_task_release(list[i]);
+}
+
+void argolib_core_async(fork_t fptr, void *args)
+{
+        if (argolib_core_fork_inline())
         {
-                ABT_thread_free(list[i]);
+                fptr(args);
+                return;
         }
 
-        // Free all the thread pointers allocated in fork
-        for (int i = 0; i < size; i++)
+        argolib_core_async_spawn(argolib_core_task_create(), fptr, args);
+}
+
+// Spawns an async task that was already registered with the finish scope p_finish,
+// to the pinned pool of worker pin unless pin is negative
+static void async_spawn_in(Task_handle *task, fork_t fptr, void *args, finish_t *p_finish, int pin)
+{
+        task->thread = ABT_THREAD_NULL;
+        task->fptr = fptr;
+        task->args = args;
+        task->state = TASK_CLAIMED;
+        task->finish = p_finish;
+        trace_assign(task);
+        task->stack = NULL;
+        task->stack_size = stack_size ? stack_size : abt_stack_size;
+
+        int rank;
+        ABT_xstream_self_rank(&rank);
+        ult_started(task->stack_size);
+        // An unnamed ULT is freed by Argobots as soon as it terminates, stack included,
+        // so Argobots has to allocate that stack
+        ABT_thread_attr attr = ABT_THREAD_ATTR_NULL;
+        if (stack_size)
+        {
+                attr = asyncAttr[rank].attr;
+                if (asyncAttr[rank].stack_size != stack_size)
+                {
+                        ABT_thread_attr_set_stacksize(attr, stack_size);
+                        asyncAttr[rank].stack_size = stack_size;
+                }
+        }
+        if (pin < 0)
+                ABT_thread_create(pools[trace_target(task, rank)], async_run, task, attr, NULL);
+        else
+        {
+                // Counted first, so the count never runs behind the pool
+                if (is_randws)
+                        __atomic_add_fetch(&idleState[pin].pinned, 1, __ATOMIC_RELEASE);
+                ABT_thread_create(pinnedPools[pin], async_run, task, attr, NULL);
+                if (is_randws)
+                        worker_wake(pin);
+        }
+        STAT_INC(rank, tasks_created);
+}
+
+void argolib_core_async_spawn(Task_handle *task, fork_t fptr, void *args)
+{
+        async_spawn_in(task, fptr, args, finish_enter(), -1);
+}
+
+void argolib_core_async_spawn_on(Task_handle *task, fork_t fptr, void *args, int worker)
+{
+        async_spawn_in(task, fptr, args, finish_enter(), worker % num_xstreams);
+}
+
+// Next task of the worker's pinned pool, if any
+static ABT_thread pinned_pop(int rank)
+{
+        ABT_thread thread = ABT_THREAD_NULL;
+        if (!__atomic_load_n(&idleState[rank].pinned, __ATOMIC_ACQUIRE))
+                return thread;
+        ABT_pool_pop_thread_ex(pinnedPools[rank], &thread, ABT_POOL_CONTEXT_OWNER_PRIMARY);
+        if (thread != ABT_THREAD_NULL)
+                __atomic_sub_fetch(&idleState[rank].pinned, 1, __ATOMIC_RELAXED);
+        return thread;
+}
+
+/** Promises
+ * Until it is put, a promise holds a stack of registrations, one per task awaiting it.
+ * The same word decides who puts it: the first putter sets its low bit (PROMISE_CLAIMED) with a
+ * CAS, and a second putter that finds the bit or PROMISE_PUT backs off without touching the datum.
+ * The winner stores the datum, then swaps the stack for PROMISE_PUT, so a task registering later
+ * sees the put, and the datum, right away.
+ * Every awaiting task counts its unsatisfied promises down, and whoever takes the count to zero,
+ * the last putter or the registering task itself, spawns it as an async task on its own worker.
+ * So a task only exists as a ULT once it can run, and no ULT ever waits for a dependency.
+ */
+#define PROMISE_PUT ((void *)2)
+#define PROMISE_CLAIMED ((uintptr_t)1)  // Registrations are pointer aligned, so the low bit is free
+
+typedef struct await_t await_t;
+typedef struct await_node_t await_node_t;
+
+struct await_node_t
+{
+        await_node_t *p_next;
+        await_t *p_task;
+};
+
+struct await_t
+{
+        int pending;            // Unsatisfied promises, plus one while the task is registering
+        fork_t fptr;
+        void *args;
+        finish_t *p_finish;
+        await_node_t nodes[];   // One per promise
+};
+
+static inline await_node_t *promise_waiters(void *p_word)
+{
+        return (await_node_t *)((uintptr_t)p_word & ~PROMISE_CLAIMED);
+}
+
+static void await_ready(await_t *p_task)
+{
+        async_spawn_in(argolib_core_task_create(), p_task->fptr, p_task->args, p_task->p_finish, -1);
+        free(p_task);
+}
+
+void argolib_core_promise_init(Promise *promise)
+{
+        promise->p_waiters = NULL;
+        promise->datum = NULL;
+}
+
+int argolib_core_promise_is_put(Promise *promise)
+{
+        return __atomic_load_n(&promise->p_waiters, __ATOMIC_ACQUIRE) == PROMISE_PUT;
+}
+
+int argolib_core_promise_claim(Promise *promise)
+{
+        void *p_word = __atomic_load_n(&promise->p_waiters, __ATOMIC_RELAXED);
+        do
+        {
+                if (p_word == PROMISE_PUT || ((uintptr_t)p_word & PROMISE_CLAIMED))
+                {
+                        fprintf(stderr, "argolib: promise %p put more than once\n", (void *)promise);
+                        return 0;
+                }
+        } while (!__atomic_compare_exchange_n(&promise->p_waiters, &p_word,
+                                              (void *)((uintptr_t)p_word | PROMISE_CLAIMED), true,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+        return 1;
+}
+
+void argolib_core_promise_put_claimed(Promise *promise, void *datum)
+{
+        // Nobody reads the datum before PROMISE_PUT is published
+        promise->datum = datum;
+        await_node_t *p_node = promise_waiters(__atomic_exchange_n(&promise->p_waiters, PROMISE_PUT,
+                                                                   __ATOMIC_ACQ_REL));
+        while (p_node)
+        {
+                // The node is part of its task's allocation, which is gone once the task runs
+                await_node_t *p_next = p_node->p_next;
+                await_t *p_task = p_node->p_task;
+                if (__atomic_sub_fetch(&p_task->pending, 1, __ATOMIC_ACQ_REL) == 0)
+                        await_ready(p_task);
+                p_node = p_next;
+        }
+}
+
+void argolib_core_promise_put(Promise *promise, void *datum)
+{
+        if (argolib_core_promise_claim(promise))
+                argolib_core_promise_put_claimed(promise, datum);
+}
+
+void argolib_core_async_await(fork_t fptr, void *args, Promise **promises, int num)
+{
+        await_t *p_task = (await_t *)malloc(sizeof(await_t) + sizeof(await_node_t) * num);
+        if (!p_task)
+        {
+                // Running the task now would break its dependencies, and dropping it would hang its
+                // finish scope
+                fprintf(stderr, "argolib: out of memory registering a task on %d promises\n", num);
+                abort();
+        }
+        p_task->pending = num + 1;
+        p_task->fptr = fptr;
+        p_task->args = args;
+        p_task->p_finish = finish_enter();
+
+        int satisfied = 1;      // Our own reference
+        for (int i = 0; i < num; i++)
+        {
+                await_node_t *p_node = &p_task->nodes[i];
+                p_node->p_task = p_task;
+                void *p_head = __atomic_load_n(&promises[i]->p_waiters, __ATOMIC_ACQUIRE);
+                while (true)
+                {
+                        if (p_head == PROMISE_PUT)
+                        {
+                                satisfied++;
+                                break;
+                        }
+                        // Keep the claim bit of a promise that is being put
+                        p_node->p_next = promise_waiters(p_head);
+                        void *p_word = (void *)((uintptr_t)p_node | ((uintptr_t)p_head & PROMISE_CLAIMED));
+                        if (__atomic_compare_exchange_n(&promises[i]->p_waiters, &p_head, p_word, true,
+                                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+                                break;
+                }
+        }
+
+        if (__atomic_sub_fetch(&p_task->pending, satisfied, __ATOMIC_ACQ_REL) == 0)
+                await_ready(p_task);
+}
+
+// trace_mode < 0 inherits the mode of the outer scope
+static void finish_scope(fork_t fptr, void *args, int trace_mode)
+{
+        finish_t finish;
+        finish.pending = 1;
+        ABT_eventual_create(0, &finish.eventual);
+
+        void *p_outer = NULL;
+        ABT_self_get_specific(finish_key, &p_outer);
+        finish.p_root = p_outer ? ((finish_t *)p_outer)->p_root : &finish;
+        finish.p_slots = NULL;
+        finish.p_at_finish = NULL;
+        if (trace_mode < 0)
+                trace_mode = p_outer ? ((finish_t *)p_outer)->trace_mode : TRACE_OFF;
+        finish.trace_mode = trace_mode;
+        ABT_self_set_specific(finish_key, &finish);
+        fptr(args);
+        ABT_self_set_specific(finish_key, p_outer);
+
+        // Drop the reference of the scope body and wait for the tasks still running
+        if (__atomic_sub_fetch(&finish.pending, 1, __ATOMIC_ACQ_REL) != 0)
+                ABT_eventual_wait(finish.eventual, NULL);
+        ABT_eventual_free(&finish.eventual);
+        if (!p_outer)
+        {
+                at_finish_run(&finish);
+                arena_release(&finish);
+        }
+}
+
+void argolib_core_finish(fork_t fptr, void *args)
+{
+        finish_scope(fptr, args, -1);
+}
+
+void argolib_core_kernel(fork_t fptr, void *args)
+{
+        // The kernel is a finish scope, so tasks that are never joined are waited for as well
+        double timeStart = ABT_get_wtime(); // Gives current time in S
+        argolib_core_finish(fptr, args);
+        double timeEnd = ABT_get_wtime();
+
+        printf("Execution Time[ms]: %f\n", (timeEnd - timeStart) * 1000.0);
+
+        print_stats();
+}
+
+/** External submission
+ * Threads that are not Argobots work units cannot push to the pools, so argolib_core_submit
+ * pushes its handle to a global inject stack with a CAS instead. A worker that finds its own
+ * pool empty, before it goes stealing, takes the oldest submission and turns it into a ULT of
+ * its own pool. Under a lock, the first worker to find the FIFO list empty takes the stack
+ * over in one exchange and reverses it into that list, so submissions start in the order they
+ * were made, one per idle worker.
+ * Each submitted task runs as a finish scope; the submitter sleeps on the handle's futex word.
+ */
+Submit_handle *p_inject = NULL;         // Newest first, pushed by the submitters
+Submit_handle *p_inject_fifo = NULL;    // Oldest first, taken from p_inject under inject_lock
+pthread_mutex_t inject_lock = PTHREAD_MUTEX_INITIALIZER;
+int inject_next = 0;    // Round robin over the pools of the default schedulers, taken with fetch-add
+
+static void inject_run(void *arg)
+{
+        Submit_handle *handle = (Submit_handle *)arg;
+        argolib_core_finish(handle->fptr, handle->args);
+        __atomic_store_n(&handle->done, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &handle->done, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static bool inject_pending()
+{
+        return __atomic_load_n(&p_inject, __ATOMIC_RELAXED) != NULL ||
+               __atomic_load_n(&p_inject_fifo, __ATOMIC_RELAXED) != NULL;
+}
+
+// Returns whether there was anything to take
+static bool inject_drain(int rank)
+{
+        pthread_mutex_lock(&inject_lock);
+        Submit_handle *handle = p_inject_fifo;
+        if (!handle)
         {
-                free(list[i]);
+                Submit_handle *p_stack = __atomic_exchange_n(&p_inject, NULL, __ATOMIC_ACQUIRE);
+                while (p_stack)
+                {
+                        Submit_handle *p_next = p_stack->p_next;
+                        p_stack->p_next = handle;
+                        handle = p_stack;
+                        p_stack = p_next;
+                }
         }
+        if (handle)
+                __atomic_store_n(&p_inject_fifo, handle->p_next, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&inject_lock);
+        if (!handle)
+                return false;
+
+        ABT_thread_create(pools[rank], inject_run, handle, ABT_THREAD_ATTR_NULL, NULL);
+        STAT_INC(rank, injected);
+        return true;
 }
 
-void argolib_core_kernel(fork_t fptr, void *args)
+Submit_handle *argolib_core_submit(fork_t fptr, void *args)
 {
-        // Task_handle *kernel_task[1];
-        // kernel_task[0] = argolib_core_fork(fptr, args);
-        // argolib_core_join(kernel_task, 1);
-        double timeStart = ABT_get_wtime(); // Gives current time in S
-        fptr(args);
-        double timeEnd = ABT_get_wtime();
+        Submit_handle *handle = (Submit_handle *)malloc(sizeof(Submit_handle));
+        if (!handle)
+                return NULL;
+        handle->fptr = fptr;
+        handle->args = args;
+        handle->done = 0;
+
+        if (!is_randws)
+        {
+                // The Argobots pools take pushes from any thread. Skip the primary stream's pool
+                // when there are others, it only runs while the main ULT waits
+                int target = __atomic_fetch_add(&inject_next, 1, __ATOMIC_RELAXED) % num_xstreams;
+                if (num_xstreams > 1 && target == 0)
+                        target = 1;
+                ABT_thread_create(pools[target], inject_run, handle, ABT_THREAD_ATTR_NULL, NULL);
+                return handle;
+        }
 
-        printf("Execution Time[ms]: %f\n", (timeEnd - timeStart) * 1000.0);
+        handle->p_next = __atomic_load_n(&p_inject, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&p_inject, &handle->p_next, handle, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                ;
+        if (__atomic_load_n(&num_parked, __ATOMIC_SEQ_CST))
+                worker_wake_any(-1);
+        else if (elastic)
+                worker_activate();
+        return handle;
+}
 
-        print_stats();
+void argolib_core_submit_wait(Submit_handle *handle)
+{
+        while (!__atomic_load_n(&handle->done, __ATOMIC_ACQUIRE))
+                syscall(SYS_futex, &handle->done, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+        free(handle);
 }
 
 void argolib_core_finalize()
@@ -259,34 +2262,90 @@ void argolib_core_finalize()
                 ABT_sched_free(&scheds[i]);
         }
         // Finalize argobots
+        ABT_key_free(&finish_key);
+        ABT_key_free(&trace_key);
+        for (int i = 0; i < num_xstreams; i++)
+        {
+                ABT_thread_attr_free(&stackAttr[i]);
+                ABT_thread_attr_free(&asyncAttr[i].attr);
+        }
+        // The default schedulers own theirs
+        if (is_randws)
+                for (int i = 0; i < num_xstreams; i++)
+                        ABT_pool_free(&pinnedPools[i]);
         ABT_finalize();
 
         // Free allocated memory
         free(xstreams);
         free(pools);
+        free(pinnedPools);
         free(scheds);
 
         free(mailBox);
         free(requestBox);
         free(sharedCounter);
-        free(requestSent);
-        free(requestServed);
+        free(idleState);
+        free(thiefState);
+        free(stackAttr);
+        free(asyncAttr);
 
-        free(pool_head_push);
-        free(pool_head_pop);
-        free(pool_tail_push);
-        free(pool_tail_pop);
-        free(pool_stolen_from);
-        free(pool_stole_from);
+        // Every ULT with a runtime stack has been joined and freed by now
+        for (int i = 0; i < num_xstreams; i++)
+        {
+                while (stackCache[i].p_head)
+                {
+                        stack_hdr_t *p_hdr = stackCache[i].p_head;
+                        stackCache[i].p_head = p_hdr->p_next;
+                        stack_unmap(p_hdr);
+                }
+        }
+        free(stackCache);
+
+        for (int i = 0; i < num_xstreams; i++)
+        {
+                arena_chunk_t *p_lists[] = {arenas[i].p_free, arenas[i].p_returned};
+                for (int k = 0; k < 2; k++)
+                {
+                        while (p_lists[k])
+                        {
+                                arena_chunk_t *p_chunk = p_lists[k];
+                                p_lists[k] = p_chunk->p_next;
+                                free(p_chunk);
+                        }
+                }
+        }
+        free(arenas);
+
+        for (int i = 0; i < num_xstreams; i++)
+                free(traceLogs[i].p_entries);
+        free(traceLogs);
+        free(workerCpu);
+        free(workerDistance);
+        free(victimOrder);
+        free(victimLevelEnd);
+        free(traceTable);
+        traceTable = NULL;
+
+#ifndef ARGOLIB_NO_STATS
+        free(stats);
+#endif
+
+        // Argobots frees its last units in ABT_finalize, so the slabs go last
+        slab_destroy(unit_slabs, num_xstreams);
+        slab_destroy(handle_slabs, num_xstreams);
+        for (int i = 0; i < CLOSURE_CLASSES; i++)
+                slab_destroy(closure_slabs[i], num_xstreams);
 }
 
 // Custom Work Stealing
 /* Pool functions */
 static ABT_unit pool_create_unit(ABT_pool pool, ABT_thread thread)
 {
-        unit_t *p_unit = (unit_t *)calloc(1, sizeof(unit_t));
+        unit_t *p_unit = (unit_t *)slab_alloc(unit_slabs, sizeof(unit_t));
         if (!p_unit)
                 return ABT_UNIT_NULL;
+        p_unit->p_prev = NULL;
+        p_unit->p_next = NULL;
         p_unit->thread = thread;
         return (ABT_unit)p_unit;
 }
@@ -294,7 +2353,7 @@ static ABT_unit pool_create_unit(ABT_pool pool, ABT_thread thread)
 static void pool_free_unit(ABT_pool pool, ABT_unit unit)
 {
         unit_t *p_unit = (unit_t *)unit;
-        free(p_unit);
+        slab_free(unit_slabs, p_unit);
 }
 
 static ABT_bool pool_is_empty(ABT_pool pool)
@@ -304,6 +2363,104 @@ static ABT_bool pool_is_empty(ABT_pool pool)
         return p_pool->p_head ? ABT_FALSE : ABT_TRUE;
 }
 
+/** Victim selection for the request/mailbox protocol
+ * A thief only sends a request to a victim holding at least its current threshold of tasks.
+ * The threshold starts at 1, grows while the requests come back empty and shrinks again
+ * on successful steals or when no victim qualifies, so a victim with a single task can always
+ * be asked eventually.
+ */
+static int next_victim(int rank, int attempt)
+{
+        thief_state_t *p_thief = &thiefState[rank];
+        int offset;
+        switch (victim_policy)
+        {
+        case VICTIM_HIERARCHICAL:
+        {
+                // Walk the distances in order, starting each one at a random worker
+                int begin = 0;
+                int *p_end = &victimLevelEnd[rank * TOPO_LEVELS];
+                int level = 0;
+                while (attempt >= p_end[level])
+                        begin = p_end[level++];
+                int size = p_end[level] - begin;
+                if (attempt == begin)
+                        p_thief->start = rand_r(&p_thief->seed) % size;
+                return victimOrder[rank * (num_xstreams - 1) + begin + (p_thief->start + attempt - begin) % size];
+        }
+        case VICTIM_RANDOM:
+                offset = rand_r(&p_thief->seed) % (num_xstreams - 1);
+                break;
+        case VICTIM_LAST:
+                if (attempt == 0 && p_thief->last_victim != -1)
+                        p_thief->start = (p_thief->last_victim - rank - 1 + num_xstreams) % num_xstreams;
+                else if (attempt == 0)
+                        p_thief->start = rand_r(&p_thief->seed) % (num_xstreams - 1);
+                offset = (p_thief->start + attempt) % (num_xstreams - 1);
+                break;
+        case VICTIM_ROUND_ROBIN:
+        default:
+                if (attempt == 0)
+                        p_thief->start = rand_r(&p_thief->seed) % (num_xstreams - 1);
+                offset = (p_thief->start + attempt) % (num_xstreams - 1);
+                break;
+        }
+        return (rank + 1 + offset) % num_xstreams;    // Never the thief itself
+}
+
+// Returns the rank the request was sent to, or -1 if no worker had enough tasks
+static int send_steal_request(int rank)
+{
+        thief_state_t *p_thief = &thiefState[rank];
+        for (int attempt = 0; attempt < num_xstreams - 1; attempt++)
+        {
+                int target = next_victim(rank, attempt);
+                if (sharedCounter[target].count < p_thief->threshold)
+                        continue;
+
+                // Cheap check before trying to claim the slot
+                if (__atomic_load_n(&requestBox[target].requester, __ATOMIC_RELAXED) != -1)
+                        continue;
+
+                // Mark the request pending first; the victim may answer right after the CAS
+                __atomic_store_n(&mailBox[rank].state, REQUEST_PENDING, __ATOMIC_RELAXED);
+                int expected = -1;
+                if (__atomic_compare_exchange_n(&requestBox[target].requester, &expected, rank, false,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                {
+                        p_thief->last_victim = target;
+                        p_thief->pending_victim = target;
+                        p_thief->sent_at = ABT_get_wtime();
+                        // A parked victim would only answer after its park times out
+                        worker_wake(target);
+                        return target;
+                }
+                __atomic_store_n(&mailBox[rank].state, REQUEST_NONE, __ATOMIC_RELAXED);
+        }
+
+        // Nobody qualified, be less picky next time
+        if (p_thief->threshold > 1)
+                p_thief->threshold--;
+        return -1;
+}
+
+static void steal_feedback(int rank, bool success)
+{
+        thief_state_t *p_thief = &thiefState[rank];
+        if (success)
+        {
+                if (p_thief->threshold > 1)
+                        p_thief->threshold--;
+        }
+        else
+        {
+                if (p_thief->threshold < steal_threshold_max)
+                        p_thief->threshold++;
+                p_thief->last_victim = -1;
+                STAT_INC(rank, steal_failures);
+        }
+}
+
 static ABT_thread pool_pop(ABT_pool pool, ABT_pool_context context)
 {
         pool_t *p_pool;
@@ -316,78 +2473,108 @@ static ABT_thread pool_pop(ABT_pool pool, ABT_pool_context context)
         int target;
 
         bool isValidRequest = false;
-        int requesterRank;
+        int requesterRank = -1;
 
-        // Always First check if there is a request in the Request Box
+        // Always First check if there is a request in the Request Box.
+        // Take it with an exchange, the thief may be retracting it at the same time
         pthread_mutex_lock(&p_pool->lock);
-        isValidRequest = requestBox[rank] != -1;
+        if (__atomic_load_n(&requestBox[rank].requester, __ATOMIC_RELAXED) != -1)
+                requesterRank = __atomic_exchange_n(&requestBox[rank].requester, -1, __ATOMIC_ACQ_REL);
+        isValidRequest = requesterRank != -1;
         if (isValidRequest)
         {
-                // printf("Valid Request\n");
-                requesterRank = requestBox[rank];
-                // There is a request in the Request Box
 
-                // Pop from the Tail
-                p_unit = p_pool->p_tail;
-                p_pool->p_tail = p_unit->p_next;
-                pool_tail_pop[rank]++;
-                pool_stolen_from[rank]++;
+                // Pop up to half of the pool from the Tail. An empty pool rejects the request
+                // explicitly, so that the thief does not wait for a task that will never come
+                mailbox_t *p_mailbox = &mailBox[requesterRank];
+                p_mailbox->p_first = p_pool->p_tail;
+                p_mailbox->p_last = NULL;
+                p_mailbox->count = 0;
+                if (p_pool->p_tail)
+                {
+                        int count = (sharedCounter[rank].count + 1) / 2;
+                        if (steal_max > 0 && count > steal_max)
+                                count = steal_max;
+                        if (count < 1)
+                                count = 1;
+
+                        unit_t *p_last = p_pool->p_tail;
+                        int taken = 1;
+                        while (taken < count && p_last != p_pool->p_head)
+                        {
+                                p_last = p_last->p_next;
+                                taken++;
+                        }
+
+                        if (p_last == p_pool->p_head)
+                        {
+                                p_pool->p_head = NULL;
+                                p_pool->p_tail = NULL;
+                        }
+                        else
+                        {
+                                p_pool->p_tail = p_last->p_next;
+                        }
+                        p_last->p_next = NULL;
+
+                        p_mailbox->p_last = p_last;
+                        p_mailbox->count = taken;
+                        STAT_ADD(rank, tail_pop, taken);
+                        STAT_ADD(rank, stolen_from, taken);
+                        sharedCounter[rank].count -= taken;  //Decrement shared counter due to pop from tail
+                }
 
-                sharedCounter[rank]--;  //Decrement shared counter due to pop from tail
-                mailBox[requesterRank] = p_unit;        // Put the popped thread on the requesters Mailbox
-                requestBox[rank] = -1;   // Clear The request
+                __atomic_store_n(&p_mailbox->state, p_mailbox->count ? REQUEST_SERVED : REQUEST_REJECTED,
+                                 __ATOMIC_RELEASE);
+        }
 
-                requestServed[requesterRank] = true;
+        // Check if our own request was answered
+        int state = __atomic_load_n(&mailBox[rank].state, __ATOMIC_ACQUIRE);
+        if (state == REQUEST_PENDING && ABT_get_wtime() - thiefState[rank].sent_at > steal_timeout_us * 1e-6)
+        {
+                // Waited too long; take the request back unless the victim is already serving it
+                int expected = rank;
+                if (__atomic_compare_exchange_n(&requestBox[thiefState[rank].pending_victim].requester, &expected, -1,
+                                                false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                {
+                        mailBox[rank].state = REQUEST_NONE;
+                        state = REQUEST_NONE;
+                        STAT_INC(rank, steal_retracts);
+                        steal_feedback(rank, false);
+                }
+        }
+        if (p_pool->p_head == NULL && (state == REQUEST_SERVED || state == REQUEST_REJECTED))
+        {
+                // The Mailbox holds a chain of stolen tasks, or nothing if the victim was empty.
+                // Splice the chain into our empty pool; the newest task becomes the head
+                mailbox_t *p_mailbox = &mailBox[rank];
+                if (p_mailbox->count)
+                {
+                        p_pool->p_tail = p_mailbox->p_first;
+                        p_pool->p_head = p_mailbox->p_last;
+                        sharedCounter[rank].count += p_mailbox->count;
+                        STAT_INC(rank, steals);
+                        STAT_INC(rank, steals_at[worker_distance(rank, thiefState[rank].pending_victim)]);
+                        STAT_ADD(rank, mailbox_tasks, p_mailbox->count);
+                }
+                steal_feedback(rank, p_mailbox->count != 0);
+                p_mailbox->p_first = NULL;
+                p_mailbox->p_last = NULL;
+                p_mailbox->count = 0;
+                p_mailbox->state = REQUEST_NONE;
+                state = REQUEST_NONE;
         }
-        // pthread_mutex_unlock(&p_pool->lock);
 
-        // pthread_mutex_lock(&p_pool->lock);
         if (p_pool->p_head == NULL)
         {
                 /* Empty. */
-                // First Check the Mailbox for a task
-                if (mailBox[rank] != NULL)
-                {
-                        // printf("MailBox Non-Empty at %d\n", rank);
-                        // Take Mutex on Mailbox as it can be Written by the Victim as well
-                        // pthread_mutex_lock(&p_pool->lock);
-                        // {
-                                // There is a task in Mailbox; pop it
-                                p_unit = mailBox[rank]; // Variable that returns the thread
-                                mailBox[rank] = NULL;   // Empty the Mailbox
-                                mailBox_task[rank]++;
-                        // }
-                        // pthread_mutex_unlock(&p_pool->lock);
-                }
-                else if(!requestSent[rank])
+                if (state == REQUEST_NONE && !replay_running())
                 {
-                        for(int i = (rank + 1) % num_xstreams; i != rank; i = (i + 1) % num_xstreams)
-                        {
-                                // Both Deque and Mailbox are empty
-                                // Send request to a Worker with non-empty deque
-                                target = i;
-
-                                pthread_mutex_lock(&pplock);
-                                int targetRequestBox = requestBox[target];
-                                pthread_mutex_unlock(&pplock);
-
-                                if (sharedCounter[target] >= 10 && targetRequestBox == -1)
-                                {
-                                        // Take lock on Request Box as it is read by the Victim as well
-                                        pthread_mutex_lock(&pplock);
-                                        // Put a Steal Request in the Request Box
-                                        // printf("Current Request box value seen by Worker %d for Target %d is %d\n", rank, target, requestBox[target]);
-                                        requestBox[target] = rank;      //Critical Section as multiple workers may be able to put request
-                                        pthread_mutex_unlock(&pplock);
-
-                                        // printf("Request Sent by Worker %d to Worker %d\n", rank, target);
-                                        requestSent[rank] = true;
-                                        break;
-                                }
-                        } // TODO: Potential Deadlock if only 2 ES and Stealer is empty and the other worker has only 1 or 0 threads
-                } else if(requestServed[rank]){
-                        requestSent[rank] = false;
-                        requestServed[rank] = false;
+                        // Both Deque and Mailbox are empty
+                        // Send request to a Worker with enough tasks in its deque
+                        target = send_steal_request(rank);
+                        if (target != -1)
+                                STAT_INC(rank, steal_requests);
                 }
         }
         else if (p_pool->p_head == p_pool->p_tail)
@@ -396,9 +2583,9 @@ static ABT_thread pool_pop(ABT_pool pool, ABT_pool_context context)
                         p_unit = p_pool->p_head;
                         p_pool->p_head = NULL;
                         p_pool->p_tail = NULL;
-                        pool_head_pop[rank]++;
+                        STAT_INC(rank, head_pop);
                         // pthread_mutex_lock(&p_pool->lock);
-                        sharedCounter[rank]--;
+                        sharedCounter[rank].count--;
                         // pthread_mutex_unlock(&p_pool->lock);
                 }
         }
@@ -407,19 +2594,20 @@ static ABT_thread pool_pop(ABT_pool pool, ABT_pool_context context)
                 /* Pop from the head. */
                 p_unit = p_pool->p_head;
                 p_pool->p_head = p_unit->p_prev;
-                pool_head_pop[rank]++;
+                STAT_INC(rank, head_pop);
                 // pthread_mutex_lock(&p_pool->lock);
-                sharedCounter[rank]--;
+                sharedCounter[rank].count--;
                 // pthread_mutex_unlock(&p_pool->lock);
         }
         pthread_mutex_unlock(&p_pool->lock);
 
+        // The thief may have gone to sleep waiting for its request
+        if (isValidRequest)
+                worker_wake(requesterRank);
+
         if (!p_unit)
                 return ABT_THREAD_NULL;
-        // pthread_mutex_lock(&pplock);
-        net_pop++;
-        pool_net_pop[rank]++;
-        // pthread_mutex_unlock(&pplock);
+        STAT_INC(rank, net_pop);
         return p_unit->thread;
 }
 
@@ -433,10 +2621,7 @@ static void pool_push(ABT_pool pool, ABT_unit unit, ABT_pool_context context)
         ABT_xstream_self_rank(&rank);
 
         pthread_mutex_lock(&p_pool->lock);
-        // pthread_mutex_lock(&pplock);
-        net_push++;
-        pool_net_push[rank]++;
-        // pthread_mutex_unlock(&pplock);
+        STAT_INC(rank, net_push);
         if (context & (ABT_POOL_CONTEXT_OP_THREAD_CREATE |
                        ABT_POOL_CONTEXT_OP_THREAD_CREATE_TO |
                        ABT_POOL_CONTEXT_OP_THREAD_REVIVE |
@@ -453,7 +2638,7 @@ static void pool_push(ABT_pool pool, ABT_unit unit, ABT_pool_context context)
                         p_pool->p_tail = p_unit;
                 }
                 p_pool->p_head = p_unit;
-                pool_head_push[rank]++;
+                STAT_INC(rank, head_push);
         }
         else
         {
@@ -470,11 +2655,21 @@ static void pool_push(ABT_pool pool, ABT_unit unit, ABT_pool_context context)
                         p_pool->p_head = p_unit;
                 }
                 p_pool->p_tail = p_unit;
-                pool_tail_push[rank]++;
+                STAT_INC(rank, tail_push);
         }
-        sharedCounter[rank]++;
+        // Count the push against the owner, which may not be the caller for injected or replayed tasks
+        sharedCounter[p_pool->rank].count++;
+        STAT_MAX(rank, max_depth, sharedCounter[p_pool->rank].count);
         // print_shared_counter();
         pthread_mutex_unlock(&p_pool->lock);
+
+        // New work: wake the owner if this was a remote push, and someone to steal it
+        if (workers_sleeping())
+        {
+                if (rank != p_pool->rank)
+                        worker_wake(p_pool->rank);
+                worker_wake_any(rank);
+        }
 }
 
 static int pool_init(ABT_pool pool, ABT_pool_config config)
@@ -502,14 +2697,296 @@ static void pool_free(ABT_pool pool)
         free(p_pool);
 }
 
-static void create_pools(int num, ABT_pool *pools)
+/* Lock-free deque functions */
+static deque_array_t *deque_array_create(int64_t size)
+{
+        deque_array_t *p_array = (deque_array_t *)malloc(sizeof(deque_array_t) + size * sizeof(unit_t *));
+        if (!p_array)
+                return NULL;
+        p_array->size = size;
+        p_array->p_retired = NULL;
+        return p_array;
+}
+
+// Called by the owner when the array is full. Copies the live range [top, bottom) into an array twice as big
+static deque_array_t *deque_grow(deque_t *p_deque, deque_array_t *p_old, int64_t top, int64_t bottom)
+{
+        deque_array_t *p_new = deque_array_create(p_old->size * 2);
+        for (int64_t i = top; i < bottom; i++)
+        {
+                unit_t *p_unit = __atomic_load_n(&p_old->buffer[i & (p_old->size - 1)], __ATOMIC_RELAXED);
+                __atomic_store_n(&p_new->buffer[i & (p_new->size - 1)], p_unit, __ATOMIC_RELAXED);
+        }
+        p_new->p_retired = p_old;
+        __atomic_store_n(&p_deque->p_array, p_new, __ATOMIC_RELEASE);
+        return p_new;
+}
+
+// Owner only: push at the bottom
+static void deque_push_bottom(deque_t *p_deque, unit_t *p_unit)
+{
+        int64_t bottom = __atomic_load_n(&p_deque->bottom, __ATOMIC_RELAXED);
+        int64_t top = __atomic_load_n(&p_deque->top, __ATOMIC_ACQUIRE);
+        deque_array_t *p_array = __atomic_load_n(&p_deque->p_array, __ATOMIC_RELAXED);
+        if (bottom - top > p_array->size - 1)
+                p_array = deque_grow(p_deque, p_array, top, bottom);
+        __atomic_store_n(&p_array->buffer[bottom & (p_array->size - 1)], p_unit, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&p_deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+// Owner only: pop from the bottom. Only races with thieves when a single unit is left
+static unit_t *deque_pop_bottom(deque_t *p_deque)
+{
+        int64_t bottom = __atomic_load_n(&p_deque->bottom, __ATOMIC_RELAXED) - 1;
+        deque_array_t *p_array = __atomic_load_n(&p_deque->p_array, __ATOMIC_RELAXED);
+        __atomic_store_n(&p_deque->bottom, bottom, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t top = __atomic_load_n(&p_deque->top, __ATOMIC_RELAXED);
+
+        unit_t *p_unit = NULL;
+        if (top <= bottom)
+        {
+                p_unit = __atomic_load_n(&p_array->buffer[bottom & (p_array->size - 1)], __ATOMIC_RELAXED);
+                if (top == bottom)
+                {
+                        // Last unit; race against the thieves for it
+                        if (!__atomic_compare_exchange_n(&p_deque->top, &top, top + 1, false,
+                                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                                p_unit = NULL;
+                        __atomic_store_n(&p_deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+                }
+        }
+        else
+        {
+                // Empty
+                __atomic_store_n(&p_deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
+        return p_unit;
+}
+
+// Thieves: steal from the top. Returns NULL if the deque is empty or another thief won the race
+static unit_t *deque_steal_top(deque_t *p_deque)
+{
+        int64_t top = __atomic_load_n(&p_deque->top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t bottom = __atomic_load_n(&p_deque->bottom, __ATOMIC_ACQUIRE);
+        if (top >= bottom)
+                return NULL;
+
+        deque_array_t *p_array = __atomic_load_n(&p_deque->p_array, __ATOMIC_ACQUIRE);
+        unit_t *p_unit = __atomic_load_n(&p_array->buffer[top & (p_array->size - 1)], __ATOMIC_RELAXED);
+        if (!__atomic_compare_exchange_n(&p_deque->top, &top, top + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                return NULL;
+        return p_unit;
+}
+
+static ABT_bool deque_pool_is_empty(ABT_pool pool)
+{
+        deque_t *p_deque;
+        ABT_pool_get_data(pool, (void **)&p_deque);
+        int64_t top = __atomic_load_n(&p_deque->top, __ATOMIC_RELAXED);
+        int64_t bottom = __atomic_load_n(&p_deque->bottom, __ATOMIC_RELAXED);
+        if (bottom > top || __atomic_load_n(&p_deque->p_inbound, __ATOMIC_RELAXED))
+                return ABT_FALSE;
+        return ABT_TRUE;
+}
+
+static ABT_thread deque_pool_pop(ABT_pool pool, ABT_pool_context context)
+{
+        deque_t *p_deque;
+        ABT_pool_get_data(pool, (void **)&p_deque);
+        unit_t *p_unit = NULL;
+
+        int rank;
+        ABT_xstream_self_rank(&rank);
+
+        if (context & ABT_POOL_CONTEXT_OWNER_SECONDARY)
+        {
+                // Another scheduler is stealing from this deque
+                p_unit = deque_steal_top(p_deque);
+                if (p_unit)
+                {
+                        STAT_INC_REMOTE(p_deque->rank, tail_pop);
+                        STAT_INC_REMOTE(p_deque->rank, stolen_from);
+                        STAT_INC(rank, stole_from);
+                        STAT_INC(rank, steals_at[worker_distance(rank, p_deque->rank)]);
+                }
+        }
+        else
+        {
+                // Move the units pushed by other execution streams to the bottom first
+                if (__atomic_load_n(&p_deque->p_inbound, __ATOMIC_RELAXED))
+                {
+                        pthread_mutex_lock(&p_deque->inbound_lock);
+                        unit_t *p_inbound = p_deque->p_inbound;
+                        p_deque->p_inbound = NULL;
+                        pthread_mutex_unlock(&p_deque->inbound_lock);
+
+                        while (p_inbound)
+                        {
+                                unit_t *p_next = p_inbound->p_next;
+                                deque_push_bottom(p_deque, p_inbound);
+                                p_inbound = p_next;
+                        }
+                }
+
+                p_unit = deque_pop_bottom(p_deque);
+                if (p_unit)
+                        STAT_INC(rank, head_pop);
+        }
+
+        if (!p_unit)
+                return ABT_THREAD_NULL;
+        STAT_INC(rank, net_pop);
+        return p_unit->thread;
+}
+
+static void deque_pool_push(ABT_pool pool, ABT_unit unit, ABT_pool_context context)
+{
+        deque_t *p_deque;
+        ABT_pool_get_data(pool, (void **)&p_deque);
+        unit_t *p_unit = (unit_t *)unit;
+
+        int rank;
+        ABT_xstream_self_rank(&rank);
+
+        STAT_INC(rank, net_push);
+        if (rank == p_deque->rank)
+        {
+                deque_push_bottom(p_deque, p_unit);
+                STAT_INC(rank, head_push);
+                STAT_MAX(rank, max_depth, (int)(__atomic_load_n(&p_deque->bottom, __ATOMIC_RELAXED) -
+                                                __atomic_load_n(&p_deque->top, __ATOMIC_RELAXED)));
+        }
+        else
+        {
+                // Only the owner may touch the bottom; hand the unit over through the inbound list
+                pthread_mutex_lock(&p_deque->inbound_lock);
+                p_unit->p_next = p_deque->p_inbound;
+                __atomic_store_n(&p_deque->p_inbound, p_unit, __ATOMIC_RELAXED);
+                pthread_mutex_unlock(&p_deque->inbound_lock);
+                STAT_INC(rank, tail_push);
+        }
+
+        // New work: wake the owner if this was a remote push, and someone to steal it
+        if (workers_sleeping())
+        {
+                if (rank != p_deque->rank)
+                        worker_wake(p_deque->rank);
+                worker_wake_any(rank);
+        }
+}
+
+static int deque_pool_init(ABT_pool pool, ABT_pool_config config)
+{
+        deque_t *p_deque = (deque_t *)aligned_alloc(64, sizeof(deque_t));
+        if (!p_deque)
+                return ABT_ERR_MEM;
+        p_deque->top = 0;
+        p_deque->bottom = 0;
+        p_deque->rank = -1;
+        p_deque->p_inbound = NULL;
+        p_deque->p_array = deque_array_create(DEQUE_INITIAL_SIZE);
+        if (!p_deque->p_array)
+        {
+                free(p_deque);
+                return ABT_ERR_MEM;
+        }
+
+        int ret = pthread_mutex_init(&p_deque->inbound_lock, 0);
+        if (ret != 0)
+        {
+                free(p_deque->p_array);
+                free(p_deque);
+                return ABT_ERR_SYS;
+        }
+        ABT_pool_set_data(pool, (void *)p_deque);
+        return ABT_SUCCESS;
+}
+
+static void deque_pool_free(ABT_pool pool)
+{
+        deque_t *p_deque;
+        ABT_pool_get_data(pool, (void **)&p_deque);
+        pthread_mutex_destroy(&p_deque->inbound_lock);
+
+        deque_array_t *p_array = p_deque->p_array;
+        while (p_array)
+        {
+                deque_array_t *p_retired = p_array->p_retired;
+                free(p_array);
+                p_array = p_retired;
+        }
+        free(p_deque);
+}
+
+// Removes the unit of thread from the owner's end of pool rank, if it is there
+static bool pool_take_head(int rank, ABT_thread thread)
+{
+        ABT_unit unit;
+        if (ABT_thread_get_unit(thread, &unit) != ABT_SUCCESS)
+                return false;
+
+        bool taken = false;
+        if (is_deque)
+        {
+                deque_t *p_deque;
+                ABT_pool_get_data(pools[rank], (void **)&p_deque);
+                int64_t bottom = __atomic_load_n(&p_deque->bottom, __ATOMIC_RELAXED) - 1;
+                int64_t top = __atomic_load_n(&p_deque->top, __ATOMIC_ACQUIRE);
+                deque_array_t *p_array = __atomic_load_n(&p_deque->p_array, __ATOMIC_RELAXED);
+                // Only the owner writes the bottom, so peeking at it is safe; a thief may still win the last unit
+                if (bottom >= top &&
+                    __atomic_load_n(&p_array->buffer[bottom & (p_array->size - 1)], __ATOMIC_RELAXED) == (unit_t *)unit)
+                        taken = deque_pop_bottom(p_deque) != NULL;
+                if (taken)
+                        STAT_INC(rank, head_pop);
+        }
+        else
+        {
+                pool_t *p_pool;
+                ABT_pool_get_data(pools[rank], (void **)&p_pool);
+                pthread_mutex_lock(&p_pool->lock);
+                if (p_pool->p_head == (unit_t *)unit)
+                {
+                        if (p_pool->p_head == p_pool->p_tail)
+                        {
+                                p_pool->p_head = NULL;
+                                p_pool->p_tail = NULL;
+                        }
+                        else
+                        {
+                                p_pool->p_head = p_pool->p_head->p_prev;
+                        }
+                        sharedCounter[rank].count--;
+                        STAT_INC(rank, head_pop);
+                        taken = true;
+                }
+                pthread_mutex_unlock(&p_pool->lock);
+        }
+        return taken;
+}
+
+static void create_pools(int num, ABT_pool *pools, bool is_deque)
 {
         /* Pool definition */
         ABT_pool_user_def def;
-        ABT_pool_user_def_create(pool_create_unit, pool_free_unit, pool_is_empty,
-                                 pool_pop, pool_push, &def);
-        ABT_pool_user_def_set_init(def, pool_init);
-        ABT_pool_user_def_set_free(def, pool_free);
+        if (is_deque)
+        {
+                ABT_pool_user_def_create(pool_create_unit, pool_free_unit, deque_pool_is_empty,
+                                         deque_pool_pop, deque_pool_push, &def);
+                ABT_pool_user_def_set_init(def, deque_pool_init);
+                ABT_pool_user_def_set_free(def, deque_pool_free);
+        }
+        else
+        {
+                ABT_pool_user_def_create(pool_create_unit, pool_free_unit, pool_is_empty,
+                                         pool_pop, pool_push, &def);
+                ABT_pool_user_def_set_init(def, pool_init);
+                ABT_pool_user_def_set_free(def, pool_free);
+        }
         /* Pool configuration */
         ABT_pool_config config;
         ABT_pool_config_create(&config);
@@ -522,6 +2999,20 @@ static void create_pools(int num, ABT_pool *pools)
         for (i = 0; i < num; i++)
         {
                 ABT_pool_create(def, config, &pools[i]);
+
+                // Each pool needs to know its owner to tell owner pushes from remote ones
+                if (is_deque)
+                {
+                        deque_t *p_deque;
+                        ABT_pool_get_data(pools[i], (void **)&p_deque);
+                        p_deque->rank = i;
+                }
+                else
+                {
+                        pool_t *p_pool;
+                        ABT_pool_get_data(pools[i], (void **)&p_pool);
+                        p_pool->rank = i;
+                }
         }
         ABT_pool_user_def_free(&def);
         ABT_pool_config_free(&config);
@@ -533,13 +3024,77 @@ static void create_pools(int num, ABT_pool *pools)
 typedef struct
 {
         uint32_t event_freq;
+        unsigned seed;  // Used to pick victims when stealing from the lock-free deques
+        int attempt;    // Failed steals in a row, for the hierarchical victim order
 } sched_data_t;
 
+// Checked right before parking, after the worker announced itself as parked
+// Work of the worker's own, not counting what it could steal
+static bool pool_has_work(int rank, ABT_pool pool)
+{
+        if (is_deque)
+                return deque_pool_is_empty(pool) == ABT_FALSE;
+        int state = __atomic_load_n(&mailBox[rank].state, __ATOMIC_RELAXED);
+        return pool_is_empty(pool) == ABT_FALSE || state == REQUEST_SERVED || state == REQUEST_REJECTED;
+}
+
+static bool worker_has_work(int rank, ABT_pool pool)
+{
+        return inject_pending() || pool_has_work(rank, pool) ||
+               __atomic_load_n(&idleState[rank].pinned, __ATOMIC_RELAXED);
+}
+
+static void worker_park(int rank, ABT_pool pool)
+{
+        idle_state_t *p_idle = &idleState[rank];
+        int seq = __atomic_load_n(&p_idle->futex, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&p_idle->parked, 1, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&num_parked, 1, __ATOMIC_SEQ_CST);
+
+        // Work pushed before we announced ourselves would not wake us up, so look once more
+        if (!worker_has_work(rank, pool))
+        {
+                struct timespec timeout = {.tv_sec = idle_park_us / 1000000,
+                                           .tv_nsec = (idle_park_us % 1000000) * 1000L};
+                syscall(SYS_futex, &p_idle->futex, FUTEX_WAIT_PRIVATE, seq, &timeout, NULL, 0);
+                STAT_INC(rank, parks);
+        }
+
+        __atomic_fetch_sub(&num_parked, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&p_idle->parked, 0, __ATOMIC_RELAXED);
+}
+
+// Sleeps while the worker is deactivated. Returns whether it is active again
+static bool worker_inactive_wait(int rank, ABT_pool pool)
+{
+        idle_state_t *p_idle = &idleState[rank];
+        int seq = __atomic_load_n(&p_idle->futex, __ATOMIC_ACQUIRE);
+        if (!__atomic_load_n(&p_idle->inactive, __ATOMIC_SEQ_CST))
+                return true;
+
+        // Work in our own pool or submitted work is ours to run, whatever max_active says
+        if (worker_has_work(rank, pool))
+        {
+                int expected = 1;
+                if (__atomic_compare_exchange_n(&p_idle->inactive, &expected, 0, false,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                        active_log(__atomic_add_fetch(&num_active, 1, __ATOMIC_RELAXED));
+                return true;
+        }
+
+        // Bounded as well, to notice stop requests
+        struct timespec timeout = {.tv_sec = elastic_interval_us / 1000000,
+                                   .tv_nsec = (elastic_interval_us % 1000000) * 1000L};
+        syscall(SYS_futex, &p_idle->futex, FUTEX_WAIT_PRIVATE, seq, &timeout, NULL, 0);
+        return !__atomic_load_n(&p_idle->inactive, __ATOMIC_ACQUIRE);
+}
+
 static int sched_init(ABT_sched sched, ABT_sched_config config)
 {
         sched_data_t *p_data = (sched_data_t *)calloc(1, sizeof(sched_data_t));
 
         ABT_sched_config_read(config, 1, &p_data->event_freq);
+        p_data->seed = (unsigned)time(NULL) ^ (unsigned)(uintptr_t)p_data;
         ABT_sched_set_data(sched, (void *)p_data);
 
         return ABT_SUCCESS;
@@ -551,10 +3106,13 @@ static void sched_run(ABT_sched sched)
         sched_data_t *p_data;
         int num_pools;
         ABT_pool *pools;
-        // int target;
+        int target;
         ABT_bool stop;
-        // unsigned seed = time(NULL);
+        int rank;
+        int idle_rounds = 0;    // Consecutive rounds without work
+        double idle_start = 0;
 
+        ABT_xstream_self_rank(&rank);
         ABT_sched_get_data(sched, (void **)&p_data);
         ABT_sched_get_num_pools(sched, &num_pools);
         pools = (ABT_pool *)malloc(num_pools * sizeof(ABT_pool));
@@ -562,36 +3120,111 @@ static void sched_run(ABT_sched sched)
 
         while (1)
         {
-                /* Execute one work unit from the scheduler's pool */
-                ABT_thread thread;
-                ABT_pool_pop_thread_ex(pools[0], &thread, ABT_POOL_CONTEXT_OWNER_PRIMARY);
+                // A deactivated worker sleeps until it is given work or the runtime shuts down
+                if (elastic && __atomic_load_n(&idleState[rank].inactive, __ATOMIC_RELAXED))
+                {
+                        if (!worker_inactive_wait(rank, pools[0]))
+                        {
+                                ABT_sched_has_to_stop(sched, &stop);
+                                if (stop == ABT_TRUE)
+                                        break;
+                                ABT_xstream_check_events(sched);
+                                continue;
+                        }
+                        if (idle_rounds)
+                                STAT_ADD(rank, idle_time, ABT_get_wtime() - idle_start);
+                        idle_rounds = 0;
+                }
+
+                // Pinned tasks come first, no other worker may run them. Once started, one
+                // belongs to our own pool, so if it blocks it is stealable like any other
+                ABT_thread thread = pinned_pop(rank);
                 if (thread != ABT_THREAD_NULL)
+                        ABT_self_schedule(thread, pools[0]);
+                else
                 {
-                        /* "thread" is associated with its original pool (pools[0]). */
-                        ABT_self_schedule(thread, ABT_POOL_NULL);
+                        // Submitted tasks come before stealing
+                        if (inject_pending() && !pool_has_work(rank, pools[0]))
+                                inject_drain(rank);
+
+                        /* Execute one work unit from the scheduler's pool */
+                        ABT_pool_pop_thread_ex(pools[0], &thread, ABT_POOL_CONTEXT_OWNER_PRIMARY);
+                        if (thread != ABT_THREAD_NULL)
+                        {
+                                /* "thread" is associated with its original pool (pools[0]). */
+                                ABT_self_schedule(thread, ABT_POOL_NULL);
+                        }
                 }
 
                 // If thread == ABT_THREAD_NULL, then the main pool must have requested
                 // another pool for a steal. Now we need to wait for the other pool to serve
                 // the request and eventually, we would have a task after it has served our request.
 
-                // else if (num_pools > 1)
-                // {
-                //         /* Steal a work unit from other pools */
-                //         target =
-                //             (num_pools == 2) ? 1 : (rand_r(&seed) % (num_pools - 1) + 1);
-                //         ABT_pool_pop_thread_ex(pools[target], &thread, ABT_POOL_CONTEXT_OWNER_SECONDARY);
-                //         if (thread != ABT_THREAD_NULL)
-                //         {
-                //                 /* "thread" is associated with its original pool
-                //                  * (pools[target]). */
-                //                 ABT_self_schedule(thread, pools[target]);
-                //         }
-                // }
+                // The lock-free deques have no request protocol; thieves steal from the top directly
+                if (thread == ABT_THREAD_NULL && is_deque && num_pools > 1 && !replay_running())
+                {
+                        /* Steal a work unit from other pools */
+                        if (victim_policy == VICTIM_HIERARCHICAL)
+                        {
+                                // pools[k] belongs to worker (rank + k) % num_xstreams
+                                int victim = next_victim(rank, p_data->attempt);
+                                target = (victim - rank + num_pools) % num_pools;
+                        }
+                        else
+                                target = (num_pools == 2) ? 1 : (rand_r(&p_data->seed) % (num_pools - 1) + 1);
+                        ABT_pool_pop_thread_ex(pools[target], &thread, ABT_POOL_CONTEXT_OWNER_SECONDARY);
+                        if (thread != ABT_THREAD_NULL)
+                        {
+                                /* Associate the stolen thread with our own pool so that it is
+                                 * pushed here, and not to the victim, when it yields or is revived. */
+                                ABT_self_schedule(thread, pools[0]);
+                                p_data->attempt = 0;
+                        }
+                        else
+                                p_data->attempt = (p_data->attempt + 1) % (num_pools - 1);
+                }
+
+                if (thread != ABT_THREAD_NULL)
+                {
+                        if (idle_rounds)
+                                STAT_ADD(rank, idle_time, ABT_get_wtime() - idle_start);
+                        idle_rounds = 0;
+                }
+                else
+                {
+                        // Back off: spin, then yield the core, then park
+                        if (idle_rounds++ == 0)
+                                idle_start = ABT_get_wtime();
+                        if (idle_rounds <= idle_spin)
+                                cpu_relax();
+                        else if (idle_rounds <= idle_spin + idle_yield)
+                                sched_yield();
+                        else
+                        {
+                                // Do not sleep through a stop request
+                                ABT_sched_has_to_stop(sched, &stop);
+                                if (stop == ABT_TRUE)
+                                        break;
+                                ABT_xstream_check_events(sched);
+                                worker_park(rank, pools[0]);
+                                if (elastic && rank != 0 &&
+                                    ABT_get_wtime() - idle_start > elastic_interval_us * 1e-6)
+                                        worker_deactivate(rank);
+                        }
+                }
 
                 if (++work_count >= p_data->event_freq)
                 {
                         work_count = 0;
+                        if (elastic && thread != ABT_THREAD_NULL)
+                        {
+                                // More tasks queued here than this worker is about to run: get help
+                                int depth;
+                                bool thief_waiting;
+                                local_load(rank, &depth, &thief_waiting);
+                                if (depth > 1 && !thief_waiting)
+                                        worker_activate();
+                        }
                         ABT_sched_has_to_stop(sched, &stop);
                         if (stop == ABT_TRUE)
                                 break;
@@ -599,6 +3232,8 @@ static void sched_run(ABT_sched sched)
                 }
         }
 
+        if (idle_rounds)
+                STAT_ADD(rank, idle_time, ABT_get_wtime() - idle_start);
         free(pools);
 }
 
@@ -7,14 +7,118 @@
 #include <stdbool.h>
 #include <abt.h>
 
-typedef ABT_thread Task_handle;
 typedef void (*fork_t)(void* args);
 
+// Bytes reserved in every task control block for the task's closure and result
+// (see argolib.hpp). Sized so that a Task_handle takes exactly two cache lines
+#define ARGOLIB_TASK_PAYLOAD 64
+
+// Control block of a forked task
+typedef struct Task_handle
+{
+        ABT_thread thread;
+        fork_t fptr;
+        void* args;
+        int state;      // Claimed atomically by whoever runs the task first: its ULT or its joiner
+        unsigned int children;  // Tasks forked so far, in trace and replay regions
+        void* finish;   // Finish scope the task was forked in
+        void* stack;    // Stack from the runtime's stack cache, NULL if Argobots allocated it
+        size_t stack_size;      // 0 for tasklets
+        unsigned long long id;  // Task ID in trace and replay regions, 0 outside them
+        unsigned char payload[ARGOLIB_TASK_PAYLOAD] __attribute__((aligned(16)));
+} Task_handle;
+
+// Task submitted from outside the runtime
+typedef struct Submit_handle
+{
+        struct Submit_handle* p_next;   // Inject stack link
+        fork_t fptr;
+        void* args;
+        int done;       // Futex word, set once the task and everything it forked are done
+} Submit_handle;
+
+// Single assignment variable that tasks can depend on
+typedef struct Promise
+{
+        void* p_waiters;        // Registrations of the tasks awaiting the promise, until it is put
+        void* datum;
+} Promise;
+
 // Core argolib API functions
 void argolib_core_init(int argc, char ** argv);
 void argolib_core_finalize();
 void argolib_core_kernel(fork_t fptr, void* args);
 Task_handle* argolib_core_fork(fork_t fptr, void* args);
+Task_handle* argolib_core_fork_leaf(fork_t fptr, void* args);
+Task_handle* argolib_core_fork_stack(fork_t fptr, void* args, size_t stack_size);
 void argolib_core_join(Task_handle** list, int size);
+void argolib_core_async(fork_t fptr, void* args);
+void argolib_core_finish(fork_t fptr, void* args);
+
+// Callable from any thread, including ones Argobots does not know about. Submit returns NULL
+// if the handle cannot be allocated
+Submit_handle* argolib_core_submit(fork_t fptr, void* args);
+void argolib_core_submit_wait(Submit_handle* handle);
+
+// Data-driven tasks: the task runs as an async task once every promise in the list has been put
+void argolib_core_promise_init(Promise* promise);
+int argolib_core_promise_is_put(Promise* promise);
+// Reserves the one put of a promise for a caller that builds the datum before putting it.
+// Returns 0, and reports the second put, if the promise was claimed or put already
+int argolib_core_promise_claim(Promise* promise);
+// Puts a promise the caller has claimed
+void argolib_core_promise_put_claimed(Promise* promise, void* datum);
+void argolib_core_promise_put(Promise* promise, void* datum);
+void argolib_core_async_await(fork_t fptr, void* args, Promise** promises, int num);
+
+// Fork and join split into their steps, so that a caller can place data in the
+// handle's payload before the task starts and read it back before the handle goes away
+Task_handle* argolib_core_task_create();
+void argolib_core_task_spawn(Task_handle* handle, fork_t fptr, void* args);
+// Same with a stack of stack_size bytes instead of the default one
+void argolib_core_task_spawn_stack(Task_handle* handle, fork_t fptr, void* args, size_t stack_size);
+void argolib_core_task_spawn_leaf(Task_handle* handle, fork_t fptr, void* args);
+void argolib_core_task_wait(Task_handle* handle);
+void argolib_core_task_release(Task_handle* handle);
+// Same for async: the handle is released by the runtime once the task has run
+void argolib_core_async_spawn(Task_handle* handle, fork_t fptr, void* args);
+// Same, but the task only ever starts on worker worker (modulo the number of workers); no
+// other worker steals it before it has started
+void argolib_core_async_spawn_on(Task_handle* handle, fork_t fptr, void* args, int worker);
+
+// Pooled storage for task closures which do not fit in a handle's payload. NULL when out of memory
+void* argolib_core_closure_alloc(size_t size);
+void argolib_core_closure_free(void* ptr);
+
+// Lazy task creation: tells whether the next fork should just run inline,
+// in which case argolib_core_inlined_task stands in for its handle
+int argolib_core_fork_inline();
+extern Task_handle argolib_core_inlined_task;
+
+// Trace and replay: run a finish scope recording which worker runs each task, or placing
+// every task on the worker recorded for it, without stealing. Replay records instead unless the
+// work stealing schedulers (ARGOLIB_RANDOMWS=1) are used
+void argolib_core_record(fork_t fptr, void* args);
+void argolib_core_replay(fork_t fptr, void* args);
+
+// Memory from the calling worker's arena, 16 byte aligned. Valid until the root finish scope
+// (kernel, outermost finish or submitted task) it was allocated in completes. NULL outside any scope
+void* argolib_core_alloc(size_t size);
+
+// Runs fptr(args) on the scope's owner once the root finish scope of the caller has completed,
+// in registration order. Returns a handle for argolib_core_at_finish_cancel, NULL outside any scope
+void* argolib_core_at_finish(fork_t fptr, void* args);
+// Keeps a registered callback from running. Call it before its root scope completes
+void argolib_core_at_finish_cancel(void* handle);
+
+// Stack size of the ULTs forked from now on, 0 for the Argobots default
+void argolib_core_set_stack_size(size_t stack_size);
+size_t argolib_core_get_stack_size();
+
+// Hints for the parallel loop templates
+int argolib_core_should_split();
+int argolib_core_num_workers();
+// Rank of the calling worker, -1 outside the runtime
+int argolib_core_worker_id();
 
 #endif
@@ -2,32 +2,23 @@
 #include "timer.h"
 
 #define SIZE (104857600)
-#define THRESHOLD (8192)
 int array[SIZE];
 
+// Same blocks as parallel_fill, so every worker sums the pages it placed
 int sum(int low, int high) {
-  if((high-low) > THRESHOLD) {
-    int x, y;
-    int mid = (low+high)/2;
-    Task_handle* task = argolib::fork([&]() {
-      x = sum(low, mid);
-    });
-    y = sum(mid, high);
-    argolib::join(task);
-    return x+y;
-  } else {
-    int x=0;
-    for(int i=low; i<high; i++) x+= array[i];
-    return x;
-  }
+  return argolib::parallel_reduce_static(low, high, 0,
+    [](int i) { return array[i]; },
+    [](int x, int y) { return x+y; });
 }
 
 int main (int argc, char ** argv) {
     argolib::init(argc, argv);
-    std::fill(array, array+SIZE, 1);
+    argolib::parallel_fill(array, array+SIZE, 1);
     int result = 0;
     timer::kernel("ArraySum kernel", [&]() {
-      result = sum(0, SIZE);
+      argolib::kernel([&]() {
+        result = sum(0, SIZE);
+      });
     });
     if(result == SIZE) std::cout<<"Test passed\n";
     else std::cout<<"Test failed\n";
@@ -0,0 +1,116 @@
+#!/bin/bash
+# Benchmark suite: builds the benchmark tests against the release library, runs every one of them
+# over a sweep of worker counts and scheduler modes, and writes one CSV row per benchmark, mode
+# and worker count with the median time, its spread and the runtime counters of the median run.
+#
+# Settings (environment variables):
+#       ARGOBOTS_INSTALL_DIR    : Argobots installation, as for the tests
+#       BENCH_WORKERS           : Worker counts to sweep. Default is 1 and the powers of two up to the number of cores
+#       BENCH_MODES             : Scheduler modes to sweep, out of fifo (Argobots pools), list (work stealing over
+#                                 the locked lists) and deque (work stealing over the lock-free deques).
+#                                 Default is "fifo list deque"
+#       BENCH_WARMUP            : Untimed runs before the trials. Default is 1
+#       BENCH_RUNS              : Timed runs. Default is 5
+#       BENCH_ONLY              : Names of the benchmarks to run. Default is all of them
+#       BENCH_CSV               : Output file. Default is bench.csv in the current directory
+
+set -e
+ROOT=$(cd "$(dirname "$0")/../.." && pwd)
+CORES=$(nproc)
+
+if [ -z "$BENCH_WORKERS" ]; then
+        BENCH_WORKERS=1
+        for ((w = 2; w < CORES; w *= 2)); do BENCH_WORKERS="$BENCH_WORKERS $w"; done
+        [ "$CORES" -gt 1 ] && BENCH_WORKERS="$BENCH_WORKERS $CORES"
+fi
+BENCH_MODES=${BENCH_MODES:-"fifo list deque"}
+BENCH_WARMUP=${BENCH_WARMUP:-1}
+BENCH_RUNS=${BENCH_RUNS:-5}
+BENCH_CSV=${BENCH_CSV:-bench.csv}
+
+# name, test directory, binary, arguments
+BENCHMARKS=(
+        "fib            fibonacci_cpp           fibonacci       30"
+        "qsort          qsort_cpp               qsort           10485760"
+        "array_sum      array_sum               array_sum"
+        "iterative      iterative_averages      iterative       static 64"
+        "uts            uts                     uts             2000 0.1249 8"
+        "nqueens        nqueens                 nqueens         13 4"
+        "strassen       strassen                strassen        1024 64"
+)
+
+mode_env() {
+        case "$1" in
+        fifo)   echo "ARGOLIB_RANDOMWS=0" ;;
+        list)   echo "ARGOLIB_RANDOMWS=1 ARGOLIB_DEQUE=0" ;;
+        deque)  echo "ARGOLIB_RANDOMWS=1 ARGOLIB_DEQUE=1" ;;
+        *)      echo "Unknown mode $1" >&2; exit 1 ;;
+        esac
+}
+
+selected() {
+        [ -z "$BENCH_ONLY" ] && return 0
+        for name in $BENCH_ONLY; do [ "$name" = "$1" ] && return 0; done
+        return 1
+}
+
+make -C "$ROOT" release
+for bench in "${BENCHMARKS[@]}"; do
+        read -r name dir binary args <<< "$bench"
+        selected "$name" || continue
+        make -C "$ROOT/tests/$dir" release ARGOLIB_INSTALL_DIR="$ROOT"
+done
+
+export LD_LIBRARY_PATH="$ROOT/release/lib:$ARGOBOTS_INSTALL_DIR/lib:$LD_LIBRARY_PATH"
+COUNTERS="tasks steals stolen_tasks steal_requests steal_failures inlined parks idle_ms"
+echo "benchmark,mode,workers,runs,median_ms,min_ms,max_ms,stddev_ms,spread_pct,$(echo $COUNTERS | tr ' ' ',')" > "$BENCH_CSV"
+
+for bench in "${BENCHMARKS[@]}"; do
+        read -r name dir binary args <<< "$bench"
+        selected "$name" || continue
+        for mode in $BENCH_MODES; do
+                for workers in $BENCH_WORKERS; do
+                        run() {
+                                env ARGOLIB_WORKERS="$workers" $(mode_env "$mode") \
+                                        "$ROOT/tests/$dir/bin/release/$binary" $args 2>&1
+                        }
+                        for ((i = 0; i < BENCH_WARMUP; i++)); do run > /dev/null; done
+
+                        # One line per trial: kernel time, then the counters
+                        trials=""
+                        for ((i = 0; i < BENCH_RUNS; i++)); do
+                                output=$(run)
+                                if echo "$output" | grep -q "failed"; then
+                                        echo "$name ($mode, $workers workers) failed:" >&2
+                                        echo "$output" >&2
+                                        exit 1
+                                fi
+                                time=$(echo "$output" | awk -F': ' '/^Execution Time\[ms\]/ { sum += $2 } END { printf "%.3f", sum }')
+                                counters=$(echo "$output" | grep '^Counters:' | tail -n 1)
+                                values=""
+                                for counter in $COUNTERS; do
+                                        value=$(echo "$counters" | tr ' ' '\n' | awk -F= -v key="$counter" '$1 == key { print $2 }')
+                                        values="$values,${value:-}"
+                                done
+                                trials="$trials$time$values"$'\n'
+                        done
+
+                        # The median run gives the counters; the spread is (max - min) / median
+                        row=$(printf "%s" "$trials" | sort -t, -k1,1g | awk -F, -v runs="$BENCH_RUNS" '
+                                { time[NR] = $1; line[NR] = $0; sum += $1; sumsq += $1 * $1 }
+                                END {
+                                        mid = int((NR + 1) / 2)
+                                        median = NR % 2 ? time[mid] : (time[mid] + time[mid + 1]) / 2
+                                        mean = sum / NR
+                                        var = sumsq / NR - mean * mean
+                                        stddev = var > 0 ? sqrt(var) : 0
+                                        spread = median > 0 ? 100 * (time[NR] - time[1]) / median : 0
+                                        counters = line[mid]
+                                        sub(/^[^,]*/, "", counters)
+                                        printf "%d,%.3f,%.3f,%.3f,%.3f,%.1f%s", runs, median, time[1], time[NR], stddev, spread, counters
+                                }')
+                        echo "$name,$mode,$workers,$row" >> "$BENCH_CSV"
+                        echo "$name,$mode,$workers,$row"
+                done
+        done
+done
@@ -15,9 +15,10 @@ void fib(fibonacci_arg_t* fib_arg)
         return;
     }
 
+    // Released all at once when the kernel completes, no matter where the children ran
     fibonacci_arg_t *x, *y;
-    x = (fibonacci_arg_t*) malloc(sizeof(fibonacci_arg_t));
-    y = (fibonacci_arg_t*) malloc(sizeof(fibonacci_arg_t));
+    x = (fibonacci_arg_t*) argolib_alloc(sizeof(fibonacci_arg_t));
+    y = (fibonacci_arg_t*) argolib_alloc(sizeof(fibonacci_arg_t));
     x->n = fib_arg->n - 1;
     y->n = fib_arg->n - 2;
 
@@ -27,9 +28,6 @@ void fib(fibonacci_arg_t* fib_arg)
     argolib_join(task_pair, 2);
 
     fib_arg->ret = x->ret + y->ret;
-
-    free(x);
-    free(y);
 }
 
 
@@ -5,19 +5,20 @@ int fib(int n)
 {
 	if(n < 2)
                 return n;
-        int x = 0, y = 0;
-        Task_handle* task1 = argolib::fork([&]() { x = fib(n-1);});
-        Task_handle* task2 = argolib::fork([&]() { y = fib(n-2);});
-        argolib::join(task1, task2);
-	return x + y;
+        // Each result comes back through the child's own task handle
+        argolib::future<int> x = argolib::fork_future([=]() { return fib(n-1);});
+        argolib::future<int> y = argolib::fork_future([=]() { return fib(n-2);});
+        int b = y.get();        // Join the last fork first, it is the one still at the head of our pool
+	return x.get() + b;
 }
 
 int main(int argc, char **argv)
 {
         argolib::init(argc, argv);
+        int n = argc > 1 ? atoi(argv[1]) : 20;
         int result;
-        argolib::kernel([&]() {result = fib(20);});
-        std::cout << "Fib(20) = " << result << std::endl;
+        argolib::kernel([&]() {result = fib(n);});
+        std::cout << "Fib(" << n << ") = " << result << std::endl;
         argolib::finalize();
         return 0;
-}
\ No newline at end of file
+}
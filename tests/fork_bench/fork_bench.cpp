@@ -0,0 +1,72 @@
+// Fork throughput of the fibonacci_cpp recursion, once through argolib::fork and once
+// the way argolib::fork used to create tasks: a heap copy of the closure per fork.
+// Run with ARGOLIB_LAZY unset so that every fork really creates a task.
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <argolib.hpp>
+
+// The old argolib::fork: copy the closure to the heap, lambda_wrapper deletes it
+template <typename T>
+Task_handle* heap_fork(T &&lambda)
+{
+        typedef typename std::remove_reference<T>::type U;
+        return argolib_core_fork(lambda_wrapper<U>, new U(lambda));
+}
+
+int fib(int n)
+{
+	if(n < 2)
+                return n;
+        int x = 0, y = 0;
+        Task_handle* task1 = argolib::fork([&]() { x = fib(n-1);});
+        Task_handle* task2 = argolib::fork([&]() { y = fib(n-2);});
+        argolib::join(task1, task2);
+	return x + y;
+}
+
+int heap_fib(int n)
+{
+	if(n < 2)
+                return n;
+        int x = 0, y = 0;
+        Task_handle* task1 = heap_fork([&]() { x = heap_fib(n-1);});
+        Task_handle* task2 = heap_fork([&]() { y = heap_fib(n-2);});
+        argolib::join(task1, task2);
+	return x + y;
+}
+
+// Every call with n >= 2 forks twice
+long forks(int n)
+{
+        long inner[2] = {0, 0};         // Calls with n >= 2 made by fib(i - 1) and fib(i)
+        for (int i = 2; i <= n; i++)
+        {
+                long next = inner[0] + inner[1] + 1;
+                inner[0] = inner[1];
+                inner[1] = next;
+        }
+        return 2 * inner[1];
+}
+
+template <typename T>
+void measure(const char *name, int n, T &&fptr)
+{
+        int result = 0;
+        auto start = std::chrono::steady_clock::now();
+        argolib::kernel([&]() { result = fptr(n); });
+        auto end = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+        std::cout << name << ": Fib(" << n << ") = " << result << ", "
+                  << forks(n) / elapsed.count() << " forks/s" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+        int n = argc > 1 ? atoi(argv[1]) : 30;
+        argolib::init(argc, argv);
+        measure("heap closure", n, heap_fib);
+        measure("inline closure", n, fib);
+        argolib::finalize();
+        return 0;
+}
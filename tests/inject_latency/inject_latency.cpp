@@ -0,0 +1,83 @@
+// Submit-to-start latency of tasks handed to argolib by plain OS threads while the workers are busy.
+// Every submitter thread submits a small parallel task, waits for it, and repeats.
+// Meanwhile the main ULT keeps the workers loaded with fib(load).
+// Usage: inject_latency [submitters] [tasks per submitter] [load]
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <argolib.hpp>
+
+typedef std::chrono::steady_clock clock_type;
+
+int fib(int n)
+{
+	if(n < 2)
+                return n;
+        int x = 0, y = 0;
+        Task_handle* task1 = argolib::fork([&]() { x = fib(n-1);});
+        Task_handle* task2 = argolib::fork([&]() { y = fib(n-2);});
+        argolib::join(task1, task2);
+	return x + y;
+}
+
+int main(int argc, char **argv)
+{
+        int submitters = argc > 1 ? atoi(argv[1]) : 4;
+        int tasks = argc > 2 ? atoi(argv[2]) : 1000;
+        int load = argc > 3 ? atoi(argv[3]) : 25;
+
+        argolib::init(argc, argv);
+        if (argolib::num_workers() < 2)
+        {
+                std::cout << "Run with ARGOLIB_WORKERS of at least 2" << std::endl;
+                argolib::finalize();
+                return 1;
+        }
+
+        std::vector<double> latencies(submitters * tasks);     // Microseconds
+        std::atomic<int> running(submitters);
+        std::vector<std::thread> threads;
+        for (int s = 0; s < submitters; s++)
+        {
+                threads.emplace_back([&, s]() {
+                        for (int i = 0; i < tasks; i++)
+                        {
+                                double *latency = &latencies[s * tasks + i];
+                                clock_type::time_point submitted = clock_type::now();
+                                Submit_handle *handle = argolib::submit([=]() {
+                                        std::chrono::duration<double, std::micro> waited = clock_type::now() - submitted;
+                                        *latency = waited.count();
+                                        fib(10);
+                                });
+                                argolib::submit_wait(handle);
+                        }
+                        running--;
+                });
+        }
+
+        // The primary execution stream only schedules while the main ULT waits, so keep it in finish scopes
+        int rounds = 0;
+        while (running > 0)
+        {
+                argolib::finish([&]() { fib(load); });
+                rounds++;
+        }
+        for (std::thread &thread : threads)
+                thread.join();
+
+        std::sort(latencies.begin(), latencies.end());
+        size_t n = latencies.size();
+        std::cout << "Submitted " << n << " tasks from " << submitters << " threads under "
+                  << rounds << " rounds of fib(" << load << ")" << std::endl;
+        std::cout << "Submit to start latency[us]: median " << latencies[n / 2]
+                  << "\tp90 " << latencies[n * 9 / 10]
+                  << "\tp99 " << latencies[n * 99 / 100]
+                  << "\tmax " << latencies[n - 1] << std::endl;
+
+        argolib::finalize();
+        return 0;
+}
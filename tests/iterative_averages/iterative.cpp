@@ -1,5 +1,6 @@
 #include "argolib.hpp"
 #include "timer.h"
+#include <cstring>
 /*
  * Ported from HJlib
  *
@@ -10,7 +11,6 @@
 //48 * 256 * 2048
 #define SIZE 10485760
 #define ITERATIONS 4096
-#define THRESHOLD 2048
 
 double* myNew, *myVal;
 int n;
@@ -25,23 +25,32 @@ int ceilDiv(int d) {
 }
 
 void recurse(uint64_t low, uint64_t high) {
-  if((high - low) > THRESHOLD) {
-    uint64_t mid = (high+low)/2;
-    Task_handle* task = argolib::fork([&]() {
-      recurse(low, mid);  
-    });
-    recurse(mid, high);
-    argolib::join(task);
-  } else {
-    for(uint64_t j=low; j<high; j++) {
-      myNew[j] = (myVal[j - 1] + myVal[j + 1]) / 2.0;
-    }
-  }
+  argolib::parallel_for(low, high, [](uint64_t j) {
+    myNew[j] = (myVal[j - 1] + myVal[j + 1]) / 2.0;
+  });
 }
 
+void recurseStatic(uint64_t low, uint64_t high) {
+  argolib::parallel_for_static(low, high, [](uint64_t j) {
+    myNew[j] = (myVal[j - 1] + myVal[j + 1]) / 2.0;
+  });
+}
+
+bool replay = false;
+bool staticBlocks = true;
+int iterations = ITERATIONS;
+
 void runParallel() {
-  for(int i=0; i<ITERATIONS; i++) {
-    recurse(1, SIZE+1);
+  for(int i=0; i<iterations; i++) {
+    if (staticBlocks) {
+      recurseStatic(1, SIZE+1);
+    } else if (!replay) {
+      recurse(1, SIZE+1);
+    } else if (i == 0) {
+      argolib::record([]() { recurse(1, SIZE+1); });
+    } else {
+      argolib::replay([]() { recurse(1, SIZE+1); });
+    }
     double* temp = myNew;
     myNew = myVal;
     myVal = temp;
@@ -50,13 +59,25 @@ void runParallel() {
 
 int main(int argc, char** argv) {
   argolib::init(argc, argv);
+  // By default every worker gets the same block in every iteration, the one parallel_fill placed.
+  // "./iterative dynamic" splits the range adaptively instead, and "./iterative replay" places
+  // every iteration's tasks as the first one ran them
+  // An optional second argument overrides the number of iterations
+  replay = argc > 1 && strcmp(argv[1], "replay") == 0;
+  staticBlocks = !replay && !(argc > 1 && strcmp(argv[1], "dynamic") == 0);
+  iterations = argc > 2 ? atoi(argv[2]) : ITERATIONS;
   myNew = new double[(SIZE + 2)];
   myVal = new double[(SIZE + 2)];
-  memset(myNew, 0, sizeof(double) * (SIZE + 2));
-  memset(myVal, 0, sizeof(double) * (SIZE + 2));
+  // Filled over [1, SIZE + 1), the range the kernel loops over, so the blocks line up
+  argolib::parallel_fill(myNew + 1, myNew + SIZE + 1, 0.0);
+  argolib::parallel_fill(myVal + 1, myVal + SIZE + 1, 0.0);
+  myNew[0] = myVal[0] = 0.0;
+  myNew[SIZE + 1] = 0.0;
   myVal[SIZE + 1] = 1.0;
   timer::kernel("Iterative Averaging Kernel", [=]() {
-    runParallel();
+    argolib::kernel([=]() {
+      runParallel();
+    });
   });
   delete(myNew);
   delete(myVal);  
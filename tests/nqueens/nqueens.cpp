@@ -0,0 +1,56 @@
+#include "argolib.hpp"
+#include <cstdlib>
+/*
+ * Counts the ways to place N queens on an N x N board. Rows are filled one at a time, with the
+ * attacked columns and diagonals kept as bit masks. The first CUTOFF rows try their columns in
+ * parallel; the search trees below them are pruned unevenly, so the tasks vary a lot in size.
+ */
+
+int N, CUTOFF;
+
+// Known solution counts, for N up to 16
+const long SOLUTIONS[] = {1, 1, 0, 0, 2, 10, 4, 40, 92, 352, 724, 2680, 14200, 73712, 365596, 2279184, 14772512};
+
+long solveSeq(int row, unsigned cols, unsigned left, unsigned right) {
+  if (row == N) return 1;
+  long count = 0;
+  unsigned avail = ~(cols | left | right) & ((1u << N) - 1);
+  while (avail) {
+    unsigned bit = avail & -avail;
+    avail ^= bit;
+    count += solveSeq(row + 1, cols | bit, (left | bit) << 1, (right | bit) >> 1);
+  }
+  return count;
+}
+
+long solvePar(int row, unsigned cols, unsigned left, unsigned right) {
+  if (row >= CUTOFF) return solveSeq(row, cols, left, right);
+  unsigned taken = cols | left | right;
+  return argolib::parallel_reduce(0, N, 0L,
+    [=](int column) {
+      unsigned bit = 1u << column;
+      if (taken & bit) return 0L;
+      return solvePar(row + 1, cols | bit, (left | bit) << 1, (right | bit) >> 1);
+    },
+    [](long x, long y) { return x + y; }, 1);
+}
+
+int main(int argc, char **argv) {
+  argolib::init(argc, argv);
+  N = argc > 1 ? atoi(argv[1]) : 13;
+  CUTOFF = argc > 2 ? atoi(argv[2]) : 4;
+  if (N < 1 || N > 16) {
+    printf("N must be between 1 and 16\n");
+    argolib::finalize();
+    return 1;
+  }
+
+  long count = 0;
+  argolib::kernel([&]() {
+    count = solvePar(0, 0, 0, 0);
+  });
+  if (count == SOLUTIONS[N]) printf("Test passed: %d queens, %ld solutions\n", N, count);
+  else printf("Test failed: %ld solutions instead of %ld\n", count, SOLUTIONS[N]);
+  argolib::finalize();
+  return 0;
+}
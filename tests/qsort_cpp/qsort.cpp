@@ -44,19 +44,30 @@ int compare(const void * a, const void * b) {
   else return 1;
 }
 
+void sort(ELEMENT_T* data, int left, int right, ELEMENT_T threshold);
+
+// A range at or below the threshold only calls the library qsort, which never blocks,
+// so it runs as a tasklet
+Task_handle* sort_task(ELEMENT_T* data, int left, int right, ELEMENT_T threshold) {
+  if (right - left + 1 > (int)threshold) {
+    return argolib::fork([=]() {
+      sort(data, left, right, threshold);
+    });
+  }
+  return argolib::fork_leaf([=]() {
+    qsort(data+left, right - left + 1, sizeof(ELEMENT_T), compare);
+  });
+}
+
 void sort(ELEMENT_T* data, int left, int right, ELEMENT_T threshold) {
   if (right - left + 1 > (int)threshold) {
     int index = partition(data, left, right);
     Task_handle *task1 = NULL, *task2 = NULL;
     if (left < index - 1) {
-      task1 = argolib::fork([&]() {
-        sort(data, left, (index - 1), threshold);
-      });
+      task1 = sort_task(data, left, (index - 1), threshold);
     }
     if (index < right) {
-      task2 = argolib::fork([&]() {
-        sort(data, index, right, threshold);
-      });
+      task2 = sort_task(data, index, right, threshold);
     }
     if(task1) argolib::join(task1);
     if(task2) argolib::join(task2);
@@ -73,12 +84,17 @@ int main(int argc, char **argv) {
   printf("Sorting %d size array with threshold of %d\n",N,threshold);
   ELEMENT_T* data = new ELEMENT_T[N];
 
-  srand(1);
-  for(int i=0; i<N; i++) {
-    data[i] = (ELEMENT_T)rand();
-  }	
+  // rand() has hidden state, so the input is a hash of the index instead
+  argolib::parallel_generate(data, data + N, [](std::ptrdiff_t i) {
+    uint64_t z = (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (ELEMENT_T)((z ^ (z >> 31)) & RAND_MAX);
+  });
   timer::kernel("QSort kernel", [=]() {
-    sort(data, 0, N-1, threshold);
+    argolib::kernel([=]() {
+      sort(data, 0, N-1, threshold);
+    });
   });
   ELEMENT_T a =0, b;
   bool ok= true;
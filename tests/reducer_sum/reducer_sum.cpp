@@ -0,0 +1,39 @@
+// The array_sum workload summed into one shared variable from every loop iteration,
+// once through an atomic and once through an argolib::reducer
+#include <atomic>
+#include "argolib.hpp"
+#include "timer.h"
+
+#define SIZE (104857600)
+int array[SIZE];
+
+int main (int argc, char ** argv) {
+    argolib::init(argc, argv);
+    argolib::parallel_fill(array, array+SIZE, 1);
+
+    std::atomic<long> atomic_sum(0);
+    timer::kernel("Atomic sum", [&]() {
+      argolib::kernel([&]() {
+        argolib::parallel_for(0, SIZE, [&](int i) {
+          atomic_sum.fetch_add(array[i], std::memory_order_relaxed);
+        });
+      });
+    });
+    double atomic_time = timer::duration();
+
+    argolib::reducer<long> reducer_sum;
+    timer::kernel("Reducer sum", [&]() {
+      argolib::kernel([&]() {
+        argolib::parallel_for(0, SIZE, [&](int i) {
+          reducer_sum.update(array[i]);
+        });
+      });
+    });
+    double reducer_time = timer::duration();
+
+    if(atomic_sum == SIZE && reducer_sum.get() == SIZE) std::cout<<"Test passed\n";
+    else std::cout<<"Test failed\n";
+    std::cout<<"Speedup of the reducer over the atomic: "<<atomic_time / reducer_time<<"\n";
+    argolib::finalize();
+  return 0;
+}
@@ -0,0 +1,98 @@
+#include "argolib.hpp"
+#include "timer.h"
+#include <memory>
+#include <cstdlib>
+/*
+ * Local alignment score of two random DNA sequences (Smith-Waterman), computed as a wavefront of tiles.
+ * Tile (i, j) needs the tiles above it and to its left, so it is an async_await task on their promises
+ * and puts its own once done. The best score of every tile is the value of its promise.
+ */
+
+#define MATCH 2
+#define MISMATCH -1
+#define GAP -1
+
+int N, TILE, TILES;
+char *seqA, *seqB;
+int *H;         // (N + 1) x (N + 1) score matrix, row and column 0 are zero
+
+inline int &h(int i, int j) {
+  return H[(size_t)i * (N + 1) + j];
+}
+
+// Fills rows [i0, i1) and columns [j0, j1) of H and returns the best score among them
+int computeBlock(int i0, int i1, int j0, int j1) {
+  int best = 0;
+  for (int i = i0; i < i1; i++) {
+    for (int j = j0; j < j1; j++) {
+      int diagonal = h(i - 1, j - 1) + (seqA[i - 1] == seqB[j - 1] ? MATCH : MISMATCH);
+      int score = std::max(std::max(0, diagonal), std::max(h(i - 1, j) + GAP, h(i, j - 1) + GAP));
+      h(i, j) = score;
+      best = std::max(best, score);
+    }
+  }
+  return best;
+}
+
+int runParallel() {
+  std::unique_ptr<argolib::promise<int>[]> tiles(new argolib::promise<int>[TILES * TILES]);
+  argolib::kernel([&]() {
+    for (int ti = 0; ti < TILES; ti++) {
+      for (int tj = 0; tj < TILES; tj++) {
+        argolib::promise<int> &self = tiles[ti * TILES + tj];
+        auto tile = [ti, tj, &self]() {
+          self.put(computeBlock(ti * TILE + 1, std::min(N, (ti + 1) * TILE) + 1,
+                                tj * TILE + 1, std::min(N, (tj + 1) * TILE) + 1));
+        };
+        // The tile up and to the left is a dependency of both of these
+        if (ti > 0 && tj > 0)
+          argolib::async_await(tile, tiles[(ti - 1) * TILES + tj], tiles[ti * TILES + tj - 1]);
+        else if (ti > 0)
+          argolib::async_await(tile, tiles[(ti - 1) * TILES + tj]);
+        else if (tj > 0)
+          argolib::async_await(tile, tiles[ti * TILES + tj - 1]);
+        else
+          argolib::async(tile);
+      }
+    }
+  });
+
+  int best = 0;
+  for (int t = 0; t < TILES * TILES; t++)
+    best = std::max(best, tiles[t].get());
+  return best;
+}
+
+int main(int argc, char **argv) {
+  argolib::init(argc, argv);
+  N = argc > 1 ? atoi(argv[1]) : 4096;
+  TILE = argc > 2 ? atoi(argv[2]) : 256;
+  TILES = (N + TILE - 1) / TILE;
+
+  const char bases[] = "ACGT";
+  seqA = new char[N];
+  seqB = new char[N];
+  srand(1);
+  for (int i = 0; i < N; i++) {
+    seqA[i] = bases[rand() % 4];
+    seqB[i] = bases[rand() % 4];
+  }
+  H = new int[(size_t)(N + 1) * (N + 1)];
+  argolib::parallel_fill(H, H + (size_t)(N + 1) * (N + 1), 0);
+
+  int parallel = 0;
+  timer::kernel("Smith-Waterman kernel", [&]() {
+    parallel = runParallel();
+  });
+
+  std::fill(H, H + (size_t)(N + 1) * (N + 1), 0);
+  int sequential = computeBlock(1, N + 1, 1, N + 1);
+  if (parallel == sequential) printf("Test passed: score %d\n", parallel);
+  else printf("Test failed: %d instead of %d\n", parallel, sequential);
+
+  delete[] seqA;
+  delete[] seqB;
+  delete[] H;
+  argolib::finalize();
+  return 0;
+}
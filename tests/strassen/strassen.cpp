@@ -0,0 +1,127 @@
+#include "argolib.hpp"
+#include <memory>
+#include <cstdlib>
+#include <cmath>
+/*
+ * Strassen matrix multiplication of two N x N matrices, N a power of two. Every level forks the
+ * seven half size products, each with temporaries of its own, and combines them once they are
+ * joined. Blocks of CUTOFF x CUTOFF or less are multiplied directly.
+ */
+
+int N, CUTOFF;
+
+typedef std::unique_ptr<double[]> matrix;
+
+// C = A + sign * B, all n x n with their own row strides
+void addBlocks(const double *A, int lda, const double *B, int ldb, double *C, int ldc, int n, double sign) {
+  for (int i = 0; i < n; i++)
+    for (int j = 0; j < n; j++)
+      C[i * ldc + j] = A[i * lda + j] + sign * B[i * ldb + j];
+}
+
+void multiplyBase(const double *A, int lda, const double *B, int ldb, double *C, int ldc, int n) {
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++)
+      C[i * ldc + j] = 0;
+    for (int k = 0; k < n; k++) {
+      double a = A[i * lda + k];
+      for (int j = 0; j < n; j++)
+        C[i * ldc + j] += a * B[k * ldb + j];
+    }
+  }
+}
+
+void strassen(const double *A, int lda, const double *B, int ldb, double *C, int ldc, int n);
+
+// M = (X1 + sx * X2) * (Y1 + sy * Y2), where a null X2 or Y2 stands for no second term
+void product(const double *X1, const double *X2, int ldx, double sx,
+             const double *Y1, const double *Y2, int ldy, double sy, double *M, int h) {
+  matrix x, y;
+  const double *left = X1, *right = Y1;
+  int ldl = ldx, ldr = ldy;
+  if (X2) {
+    x.reset(new double[(size_t)h * h]);
+    addBlocks(X1, ldx, X2, ldx, x.get(), h, h, sx);
+    left = x.get();
+    ldl = h;
+  }
+  if (Y2) {
+    y.reset(new double[(size_t)h * h]);
+    addBlocks(Y1, ldy, Y2, ldy, y.get(), h, h, sy);
+    right = y.get();
+    ldr = h;
+  }
+  strassen(left, ldl, right, ldr, M, h, h);
+}
+
+void strassen(const double *A, int lda, const double *B, int ldb, double *C, int ldc, int n) {
+  if (n <= CUTOFF) {
+    multiplyBase(A, lda, B, ldb, C, ldc, n);
+    return;
+  }
+  int h = n / 2;
+  const double *A11 = A, *A12 = A + h, *A21 = A + h * lda, *A22 = A + h * lda + h;
+  const double *B11 = B, *B12 = B + h, *B21 = B + h * ldb, *B22 = B + h * ldb + h;
+  size_t size = (size_t)h * h;
+  matrix products(new double[7 * size]);
+  double *M[7];
+  for (int k = 0; k < 7; k++)
+    M[k] = products.get() + k * size;
+
+  Task_handle *t1 = argolib::fork([=]() { product(A11, A22, lda, 1, B11, B22, ldb, 1, M[0], h); });
+  Task_handle *t2 = argolib::fork([=]() { product(A21, A22, lda, 1, B11, nullptr, ldb, 0, M[1], h); });
+  Task_handle *t3 = argolib::fork([=]() { product(A11, nullptr, lda, 0, B12, B22, ldb, -1, M[2], h); });
+  Task_handle *t4 = argolib::fork([=]() { product(A22, nullptr, lda, 0, B21, B11, ldb, -1, M[3], h); });
+  Task_handle *t5 = argolib::fork([=]() { product(A11, A12, lda, 1, B22, nullptr, ldb, 0, M[4], h); });
+  Task_handle *t6 = argolib::fork([=]() { product(A21, A11, lda, -1, B11, B12, ldb, 1, M[5], h); });
+  Task_handle *t7 = argolib::fork([=]() { product(A12, A22, lda, -1, B21, B22, ldb, 1, M[6], h); });
+  argolib::join(t7, t6, t5, t4, t3, t2, t1);
+
+  double *C11 = C, *C12 = C + h, *C21 = C + h * ldc, *C22 = C + h * ldc + h;
+  for (int i = 0; i < h; i++) {
+    for (int j = 0; j < h; j++) {
+      size_t k = (size_t)i * h + j;
+      C11[i * ldc + j] = M[0][k] + M[3][k] - M[4][k] + M[6][k];
+      C12[i * ldc + j] = M[2][k] + M[4][k];
+      C21[i * ldc + j] = M[1][k] + M[3][k];
+      C22[i * ldc + j] = M[0][k] - M[1][k] + M[2][k] + M[5][k];
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  argolib::init(argc, argv);
+  N = argc > 1 ? atoi(argv[1]) : 1024;
+  CUTOFF = argc > 2 ? atoi(argv[2]) : 64;
+  if (N < 1 || (N & (N - 1)) || CUTOFF < 1) {
+    printf("N must be a power of two and CUTOFF positive\n");
+    argolib::finalize();
+    return 1;
+  }
+
+  size_t size = (size_t)N * N;
+  matrix A(new double[size]), B(new double[size]), C(new double[size]);
+  // Small integers keep every intermediate sum exact
+  argolib::parallel_generate(A.get(), A.get() + size, [](std::ptrdiff_t i) { return (double)((i * 7 + 3) % 4); });
+  argolib::parallel_generate(B.get(), B.get() + size, [](std::ptrdiff_t i) { return (double)((i * 5 + 1) % 3); });
+  argolib::parallel_fill(C.get(), C.get() + size, 0.0);
+
+  argolib::kernel([&]() {
+    strassen(A.get(), N, B.get(), N, C.get(), N, N);
+  });
+
+  // Check a sample of the entries against the plain definition
+  bool ok = true;
+  srand(1);
+  for (int s = 0; s < 256; s++) {
+    int i = rand() % N, j = rand() % N;
+    double expected = 0;
+    for (int k = 0; k < N; k++)
+      expected += A[(size_t)i * N + k] * B[(size_t)k * N + j];
+    ok &= std::fabs(C[(size_t)i * N + j] - expected) < 1e-6;
+  }
+  if (ok) printf("Test passed\n");
+  else printf("Test failed\n");
+  argolib::finalize();
+  return 0;
+}
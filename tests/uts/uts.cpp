@@ -0,0 +1,69 @@
+#include "argolib.hpp"
+#include <cstdint>
+#include <cstdlib>
+/*
+ * Unbalanced Tree Search on a binomial tree: the root has B0 children and every other node has
+ * M children with probability Q, none otherwise. The subtrees differ wildly in size, so the
+ * work only balances through stealing. A node's shape is a hash of its parent's state and its
+ * index among the siblings, so the tree is the same for any schedule.
+ */
+
+int B0, M;
+double Q;
+int HASH_ROUNDS;        // Extra hashing per node, standing in for the SHA-1 of the original benchmark
+
+uint64_t mix(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+uint64_t childState(uint64_t parent, int index) {
+  uint64_t z = parent + (uint64_t)(index + 1) * 0x9e3779b97f4a7c15ULL;
+  for (int r = 0; r < HASH_ROUNDS; r++)
+    z = mix(z);
+  return mix(z);
+}
+
+int numChildren(uint64_t state, bool root) {
+  if (root) return B0;
+  return (state >> 11) * 0x1.0p-53 < Q ? M : 0;
+}
+
+// Number of nodes in the subtree rooted at state
+long countSeq(uint64_t state, bool root) {
+  long nodes = 1;
+  int children = numChildren(state, root);
+  for (int i = 0; i < children; i++)
+    nodes += countSeq(childState(state, i), false);
+  return nodes;
+}
+
+long countPar(uint64_t state, bool root) {
+  int children = numChildren(state, root);
+  if (children == 0) return 1;
+  return 1 + argolib::parallel_reduce(0, children, 0L,
+    [=](int i) { return countPar(childState(state, i), false); },
+    [](long x, long y) { return x + y; }, 1);
+}
+
+int main(int argc, char **argv) {
+  argolib::init(argc, argv);
+  B0 = argc > 1 ? atoi(argv[1]) : 2000;
+  Q = argc > 2 ? atof(argv[2]) : 0.1249;
+  M = argc > 3 ? atoi(argv[3]) : 8;
+  HASH_ROUNDS = argc > 4 ? atoi(argv[4]) : 16;
+  // Paths in the tree run hundreds of nodes deep, far beyond the default ULT stack
+  argolib::set_stack_size(1 << 20);
+  printf("UTS binomial tree: b0 = %d, q = %f, m = %d\n", B0, Q, M);
+
+  long parallel = 0;
+  argolib::kernel([&]() {
+    parallel = countPar(1, true);
+  });
+  long sequential = countSeq(1, true);
+  if (parallel == sequential) printf("Test passed: %ld nodes\n", parallel);
+  else printf("Test failed: %ld nodes instead of %ld\n", parallel, sequential);
+  argolib::finalize();
+  return 0;
+}